@@ -0,0 +1,93 @@
+#ifndef ATTRIBUTE_MAP_GENERATOR_H
+#define ATTRIBUTE_MAP_GENERATOR_H
+
+#include <opencv2/imgproc.hpp>
+
+namespace fabsoften {
+
+/// AttributeMapOptions - Options for controlling how facial attributes drive the filter.
+class AttributeMapOptions {
+public:
+  /// \brief Downsampling factor of the grid the attributes are estimated on.
+  ///
+  /// The attributes vary slowly across the face, so they are estimated on a grid this many
+  /// times coarser than the image and bilinearly upsampled.
+  int gridScale;
+
+  /// Side length of the neighborhood the attributes are averaged over, as a fraction of
+  /// the shorter side of the image.
+  float windowRate;
+
+  /// Fraction of blemish pixels in a neighborhood at which the density saturates to 1.
+  float densitySaturation;
+
+  /// Standard deviation of the gray levels in a neighborhood at which the texture
+  /// saturates to 1.
+  float textureSaturation;
+
+  /// Relative growth of the radius in neighborhoods saturated with blemishes.
+  float radiusDensityGain;
+
+  /// Relative growth of eps in neighborhoods saturated with blemishes.
+  float epsDensityGain;
+
+  /// Relative shrinkage of the radius and eps in neighborhoods saturated with texture.
+  float textureDamping;
+
+  /// Maximum number of distinct radius scales, at least 3. At most
+  /// \ref RadiusSpans::MaxRunningRadii keeps the filter on its running-sum path.
+  int radiusLevels;
+
+public:
+  AttributeMapOptions()
+      : gridScale(8), windowRate(0.05f), densitySaturation(0.1f), textureSaturation(16),
+        radiusDensityGain(0.5f), epsDensityGain(2), textureDamping(0.5f), radiusLevels(8) {}
+};
+
+/// \brief Class for generating the attribute-aware radius and eps maps of the filter.
+///
+/// The maps are relative scales of \ref GFOptions::radius4skin and \ref GFOptions::eps,
+/// so they only depend on the image and its blemishes, not on the strength settings.
+class AttributeMapGenerator {
+public:
+  AttributeMapOptions opts;
+
+public:
+  explicit AttributeMapGenerator(AttributeMapOptions op = AttributeMapOptions())
+      : opts(op) {}
+
+  /// \brief Estimate the radius and eps scale maps from blemish density and skin texture.
+  ///
+  /// \param src [in] Input image. e.g. the `workImg` of \ref Beautifier.
+  /// \param blemishes [in] Contours of the detected blemishes in \p src.
+  void generate(const cv::Mat &src, const std::vector<std::vector<cv::Point>> &blemishes);
+
+  /// Whether maps of size \p size have been generated.
+  bool hasMaps(cv::Size size) const {
+    return !radiusScale.empty() && radiusScale.size() == size;
+  }
+
+  /// Drop the cached maps so that the next \ref generate call is not skipped.
+  void clear() {
+    radiusScale.release();
+    epsScale.release();
+  }
+
+  /// Per-pixel scale of \ref GFOptions::radius4skin(CV_32FC1).
+  const cv::Mat &getRadiusScale() const { return radiusScale; }
+
+  /// Per-pixel scale of \ref GFOptions::eps(CV_32FC1).
+  const cv::Mat &getEpsScale() const { return epsScale; }
+
+private:
+  cv::Mat grayImg;
+  cv::Mat densityImg;
+  cv::Mat textureImg;
+  cv::Mat workImg;
+  cv::Mat radiusScale;
+  cv::Mat epsScale;
+};
+
+} // namespace fabsoften
+
+#endif
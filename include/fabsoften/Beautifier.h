@@ -1,10 +1,12 @@
 #ifndef BEAUTIFIER_H
 #define BEAUTIFIER_H
 
+#include "fabsoften/AttributeMapGenerator.h"
 #include "fabsoften/BlemishRemover.h"
 #include "fabsoften/FaceLandmarkDetector.h"
 #include "fabsoften/GuidedFilter.h"
 #include "fabsoften/SkinMaskGenerator.h"
+#include "fabsoften/TextureRestorer.h"
 
 namespace fabsoften {
 
@@ -68,6 +70,11 @@ public:
   /// \param img Drawing target with eltype `CV_8UC1`.
   void drawBinaryMask(cv::Mat &img) { maskGen->generateBinaryMask(getFace(), img); }
 
+  /// \brief Draw a feathered soft mask of \ref workImg.
+  ///
+  /// \param img Drawing target with eltype `CV_8UC1`.
+  void drawSoftMask(cv::Mat &img) { maskGen->generateSoftMask(getFace(), workImg, img); }
+
   bool hasBlemishRemover() const { return blemishRM != nullptr; }
 
   BlemishRemover &getBlemishRemover() const {
@@ -79,11 +86,34 @@ public:
   const BlemishRemoverOptions &getBlemishRemoverOpts() const { return blemishRM->opts; }
 
   /// \brief Remove blemishes.
-  /// \param mask [in] Binary mask(CV_8UC1).
+  /// \param mask [in] Binary mask(CV_8UC1), or the nonzero pixels of a soft mask.
   void concealBlemish(const cv::Mat &mask) {
     blemishRM->concealBlemish(workImg.clone(), workImg, mask);
   }
 
+  bool hasAttributeMapGenerator() const { return attrMapGen != nullptr; }
+
+  AttributeMapGenerator &getAttributeMapGenerator() const {
+    assert(attrMapGen && "Beautifier has no AttributeMapGenerator!");
+    return *attrMapGen;
+  }
+
+  AttributeMapOptions &getAttributeMapOpts() { return attrMapGen->opts; }
+  const AttributeMapOptions &getAttributeMapOpts() const { return attrMapGen->opts; }
+
+  /// \brief Estimate the attribute maps of \ref workImg from the detected blemishes.
+  ///
+  /// The maps are cached, they are only regenerated when the size of the work image
+  /// changes or after \ref clearAttributeMaps, so re-running \ref soften with different
+  /// \ref GFOptions does not estimate them again.
+  void generateAttributeMaps() {
+    if (!attrMapGen->hasMaps(workImg.size()))
+      attrMapGen->generate(workImg, blemishRM->getBlemishes());
+  }
+
+  /// Drop the cached attribute maps, e.g. after changing \ref AttributeMapOptions.
+  void clearAttributeMaps() { attrMapGen->clear(); }
+
   bool hasGuidedFilter() const { return gf != nullptr; }
 
   GuidedFilter &getGuidedFilter() const {
@@ -104,6 +134,46 @@ public:
     gf->applyADF(mask, guidance, src, dst);
   }
 
+  /// \brief Blurs a color image with the cached attribute maps.
+  /// \param mask [in] Binary Mask(CV_8UC1).
+  /// \param guidance [in] Guidance Color Image.
+  /// \param src [in] Input color image.
+  /// \param dst [out] Output image of the same size and type as src.
+  void applyAttributeAwareADF(const cv::Mat &mask, const cv::Mat &guidance,
+                              const cv::Mat &src, cv::Mat &dst) {
+    gf->applyADF(mask, guidance, src, dst, attrMapGen->getRadiusScale(),
+                 attrMapGen->getEpsScale());
+  }
+
+  bool hasTextureRestorer() const { return textureRS != nullptr; }
+
+  TextureRestorer &getTextureRestorer() const {
+    assert(textureRS && "Beautifier has no TextureRestorer!");
+    return *textureRS;
+  }
+
+  TextureRestorationOptions &getTextureRestorationOpts() { return textureRS->opts; }
+  const TextureRestorationOptions &getTextureRestorationOpts() const {
+    return textureRS->opts;
+  }
+
+  /// \brief Restore the fine skin texture of \ref workImg onto the smoothed image.
+  /// \param mask [in] Skin mask(CV_8UC1), or empty to restore the detail everywhere.
+  /// \param smoothed [in] Smoothed color image.
+  /// \param dst [out] Output image(CV_8UC3).
+  void restoreTexture(const cv::Mat &mask, const cv::Mat &smoothed, cv::Mat &dst) {
+    textureRS->extractDetail(workImg);
+    textureRS->restore(mask, smoothed, dst);
+  }
+
+  /// \brief Blend the beautified image over the original with a soft mask.
+  /// \param mask [in] Soft mask(CV_8UC1), the alpha of \p src.
+  /// \param src [in] Beautified image(CV_8UC3).
+  /// \param background [in] Original image(CV_8UC3).
+  /// \param dst [out] Output image(CV_8UC3).
+  void composite(const cv::Mat &mask, const cv::Mat &src, const cv::Mat &background,
+                 cv::Mat &dst);
+
   const cv::Mat getInputImage() const { return inputImg; }
   const cv::Mat getWorkImage() const { return workImg; }
   const cv::Mat getOutputImage() const { return outputImg; }
@@ -143,9 +213,15 @@ private:
   /// Blemish Remover
   std::unique_ptr<BlemishRemover> blemishRM;
 
+  /// Attribute Map Generator
+  std::unique_ptr<AttributeMapGenerator> attrMapGen;
+
   /// Attribute-aware Dynamic Guided Filter
   std::unique_ptr<GuidedFilter> gf;
 
+  /// Texture Restorer
+  std::unique_ptr<TextureRestorer> textureRS;
+
   /// Maintain a intact copy of the input image
   cv::Mat inputImg;
 
@@ -158,7 +234,9 @@ private:
   /// Output image
   cv::Mat outputImg;
 
-  cv::Mat maskImg3C;
+  /// Blending weights of \ref composite
+  cv::Mat alphaImg;
+  cv::Mat alphaImg2;
 
   cv::Mat tmpImg;
   cv::Mat tmpImg2;
@@ -8,11 +8,16 @@ namespace fabsoften {
 /// BlemishRemoverOptions - Options for controlling the effect of blemish concealment.
 class BlemishRemoverOptions {
 public:
-  /// Reserved
-  unsigned Reserved : 1;
+  /// \brief Side length of the tiles the local detection stages are fused over.
+  ///
+  /// The threshold against the local mean, the erosion and the Gaussian before the Canny
+  /// edge detection run one tile and its halo at a time, so their intermediates stay in
+  /// L2 and only the map the edges are detected on is written out. The result does not
+  /// depend on it. Set it to 0 to process the whole image at once.
+  int tileSize;
 
 public:
-  BlemishRemoverOptions() : Reserved(true) {}
+  BlemishRemoverOptions() : tileSize(256) {}
 };
 
 /// \brief Class for removing blemishes.
@@ -25,6 +30,9 @@ public:
 
   /// \brief Compute the Difference of Gaussian for the intensity channel of the image.
   ///
+  /// The masked DoG is thresholded against its local mean, eroded and smoothed, ready for
+  /// \ref runCannyEdgeDetection.
+  ///
   /// \param src Input image. e.g. the `workImg` of \ref Beautifier.
   /// \param mask Binary mask with eltype `CV_8UC1`.
   void computeDoG(const cv::Mat &src, const cv::Mat &mask);
@@ -42,8 +50,19 @@ public:
   /// \param mask [in] Binary mask with eltype `CV_8UC1`.
   void concealBlemish(const cv::Mat &src, cv::Mat &dst, const cv::Mat &mask);
 
+  /// Whether a contour found by \ref runCannyEdgeDetection outlines a blemish.
+  static bool isBlemish(const std::vector<cv::Point> &contour);
+
+  /// Return the contours of the blemishes found by the last \ref concealBlemish call.
+  std::vector<std::vector<cv::Point>> getBlemishes() const;
+
+  /// The map left by the last detection stage(CV_8UC1), i.e. the smoothed map the edges
+  /// are detected on after \ref computeDoG.
+  const cv::Mat &getEdgeMap() const { return workImg; }
+
 private:
   cv::Mat grayImg;
+  cv::Mat dogImg;
   cv::Mat workImg;
   cv::Mat workImg2;
   std::vector<std::vector<cv::Point>> contours;
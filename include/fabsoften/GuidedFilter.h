@@ -1,9 +1,13 @@
 #ifndef GUIDED_FILTER_H
 #define GUIDED_FILTER_H
 
+#include <cstdint>
+#include <functional>
 #include <iostream>
 #include <opencv2/core.hpp>
 #include <opencv2/imgproc.hpp>
+#include <span>
+#include <vector>
 
 namespace fabsoften {
 
@@ -16,8 +20,271 @@ public:
   /// The radius parameter in Guided Filtering for skin regions.
   float radius4skin;
 
+  /// \brief Subsampling factor of the fast guided filter, must be a power of two.
+  ///
+  /// The statistics and the a & b coefficients are computed on an image subsampled by this
+  /// factor, only the averaged coefficients are upsampled and applied at full resolution.
+  /// Set it to 1 to run the filter at full resolution.
+  int subsample;
+
+  /// \brief Side length of the tiles the full resolution filter processes one at a time.
+  ///
+  /// Each tile is filtered with a halo of twice the largest radius, so the intermediate
+  /// planes only ever cover one tile and its halo. For 8-bit inputs whose radius map has
+  /// at most \ref RadiusSpans::MaxRunningRadii distinct radii, the output is bit-identical
+  /// to filtering the whole image at once. Set it to 0 to derive it from \ref tileBudget.
+  int tileSize;
+
+  /// \brief Bytes the planes of one tile and its halo may take, when \ref tileSize is 0.
+  ///
+  /// The tiles are the largest squares whose statistics, coefficients and summed-area
+  /// tables fit in the budget, which keeps the working set of each pass close to the
+  /// cache. The default is sized for a large L2(or a slice of L3) cache. Tiles are never
+  /// smaller than their halo on either side, which caps the statistics recomputed in the
+  /// halos; a budget too small for that is exceeded. Set it to 0 to process the whole
+  /// image at once.
+  size_t tileBudget;
+
+  /// \brief Depth of the full-size statistics and coefficient planes, CV_32F or CV_16F.
+  ///
+  /// CV_16F halves the memory traffic and footprint of the filter. The planes are only
+  /// widened to float and double inside the kernels, at the cost of a small loss of
+  /// precision: the statistics of 8-bit inputs are no longer summed exactly and the tiled
+  /// filter is no longer guaranteed to be bit-identical to the untiled one. It requires an
+  /// 8-bit input and guidance, or float ones within [-255, 255], so that their products
+  /// fit in half precision; \ref lumaOnly therefore takes 8-bit images only. The
+  /// statistics of 16-bit inputs are kept in double either way, as their products exceed
+  /// the precision of float.
+  int storageDepth;
+
+  /// \brief Whether \ref GuidedFilter::applyADF only smooths the luminance.
+  ///
+  /// The image is filtered in YCrCb: only Y goes through the guided filter, which has a
+  /// third of the input channels to carry through the statistics and the coefficients.
+  /// Cr and Cb are handled according to \ref chromaSubsample.
+  bool lumaOnly;
+
+  /// \brief How the chroma is smoothed when \ref lumaOnly is set.
+  ///
+  /// 0 passes Cr and Cb through. Otherwise they are box filtered on a grid subsampled by
+  /// this factor, with the skin radius scaled down accordingly, and upsampled. Only the
+  /// chroma of the masked pixels is averaged, normalized by the box-filtered mask.
+  int chromaSubsample;
+
+  /// \brief Whether color guidance is converted to gray before filtering.
+  ///
+  /// Gray guidance only needs the mean and the variance of the guidance and a scalar
+  /// divide per pixel, instead of six covariance planes and a 3x3 inverse. It gives up
+  /// the edges that only show up in color. Gray guidance images are always filtered this
+  /// way.
+  bool grayGuidance;
+
+  /// \brief Depth of the output of the filter, CV_8U, CV_16U or CV_32F.
+  ///
+  /// Integer outputs are rounded and saturated as they are written. -1 keeps the depth of
+  /// the input image. The full resolution filter of an 8-bit input and guidance into an
+  /// 8-bit output runs in fixed point: a & b are solved from the exact window sums of the
+  /// integer statistics into CV_32S planes, summed exactly and applied in integers. It may
+  /// round a few pixels differently from the float output, and its statistics are not
+  /// cached. Half-precision storage and regions of more than 2^27 pixels use the float
+  /// path.
+  int outputDepth;
+
+  /// \brief Whether the windowed statistics of the last call are kept for the next one.
+  ///
+  /// The means and covariances of the input and the guidance do not depend on eps. A call
+  /// with the same input, guidance and radius map(compared by a hash of their contents)
+  /// only solves for the coefficients again and averages them, which keeps interactive
+  /// changes of eps responsive. The statistics take one float per statistic and pixel of
+  /// the subsampled region. The whole image is filtered at once rather than in tiles
+  /// derived from \ref tileBudget, calls with a fixed \ref tileSize are never cached.
+  bool cacheStatistics;
+
+public:
+  GFOptions()
+      : eps(300), radius4skin(20), subsample(1), tileSize(0), tileBudget(8 << 20),
+        storageDepth(CV_32F), lumaOnly(false), chromaSubsample(0), grayGuidance(false),
+        outputDepth(CV_32F), cacheStatistics(false) {}
+};
+
+/// EpsMap - The epsilon parameter of Guided Filtering, uniform or per pixel.
+class EpsMap {
+public:
+  /// A uniform eps.
+  EpsMap(double eps) : value(eps) {}
+
+  /// \brief A per-pixel eps.
+  /// \param map [in] eps of each pixel(CV_32FC1), or indices into \p table(CV_8UC1).
+  /// \param table [in] Distinct eps values looked up by an 8-bit \p map.
+  EpsMap(const cv::Mat &map, std::vector<float> table = {})
+      : value(0), map(map), table(std::move(table)) {
+    CV_Assert(map.type() == CV_32FC1 || (map.type() == CV_8UC1 && !this->table.empty()));
+  }
+
+  /// Whether all of the pixels share \ref value.
+  bool isUniform() const { return map.empty(); }
+
+  /// The eps of a region of the image.
+  EpsMap operator()(const cv::Rect &roi) const {
+    return isUniform() ? EpsMap(value) : EpsMap(map(roi), table);
+  }
+
+  /// \brief Write the eps of the first \p n pixels of the x-th row.
+  void fillRow(int x, float *dst, int n) const;
+
+  /// The uniform eps.
+  double value;
+
+  /// eps of each pixel(CV_32FC1), or indices into \ref table(CV_8UC1).
+  cv::Mat map;
+
+  /// Distinct eps values looked up by an 8-bit \ref map.
+  std::vector<float> table;
+};
+
+/// RadiusSpan - A run of pixels in one row that share the same radius.
+class RadiusSpan {
+public:
+  /// The run is a copy of the source(radius 0).
+  static constexpr int Identity = -1;
+
+  /// The run is evaluated with integral image lookups.
+  static constexpr int Integral = -2;
+
+  /// First column of the run.
+  int begin;
+
+  /// One past the last column of the run.
+  int end;
+
+  /// The radius shared by all of the pixels in the run.
+  float radius;
+
+  /// Index into \ref RadiusSpans::radii, or one of \ref Identity and \ref Integral.
+  int slot;
+};
+
+/// \brief Run-length layout of a radius map.
+///
+/// Each row of the radius map is split into runs of constant radius. Runs are evaluated
+/// with sliding-window running sums, one set per distinct radius; only when there are more
+/// distinct radii than \ref MaxRunningRadii do the remaining ones fall back to integral
+/// image lookups. A fractional radius r covers `[x - ceil(r), x + floor(r)]`, the same
+/// window as an integral image lookup. Windows clipped by the border are normalized by
+/// their clipped area, i.e. they average the pixels they cover.
+class RadiusSpans {
+public:
+  /// The maximum number of distinct radii served by running sums.
+  static constexpr int MaxRunningRadii = 8;
+
+  /// \brief Build the layout from a radius map.
+  /// \param radius [in] Float-valued matrix contains radius info for each pixel(CV_32FC1).
+  void analyze(const cv::Mat &radius);
+
+  /// Return the runs of the \p x-th row.
+  std::span<const RadiusSpan> row(int x) const {
+    return {spans.data() + rowStarts[x], spans.data() + rowStarts[x + 1]};
+  }
+
+  /// The size of the analyzed radius map.
+  cv::Size size;
+
+  /// Runs of all rows, stored row by row.
+  std::vector<RadiusSpan> spans;
+
+  /// Offsets of the first run of each row in \ref spans.
+  std::vector<size_t> rowStarts;
+
+  /// Distinct radii served by running sums.
+  std::vector<float> radii;
+
+  /// Whether any of the runs falls back to integral image lookups.
+  bool needsIntegral = false;
+
+  /// The largest radius of the map.
+  float maxRadius = 0;
+
+  /// Reciprocals of the window widths up to that of \ref maxRadius, indexed by the width.
+  std::vector<double> invWidths;
+
+private:
+  int slotOf(float r);
+};
+
+/// \brief Assignment of the intermediate planes of a pipeline to physical buffers.
+///
+/// Every plane is live from the first to the last pass of the pipeline that touches it.
+/// Planes whose live ranges do not overlap share a physical buffer, which is sized for the
+/// largest of them.
+class BufferPlan {
+public:
+  /// An intermediate plane of the pipeline.
+  struct Plane {
+    /// Name of the plane, for reports.
+    const char *name;
+
+    /// Size of the plane in bytes.
+    size_t bytes;
+
+    /// The first pass that touches the plane.
+    int first;
+
+    /// The last pass that touches the plane.
+    int last;
+
+    /// Index into \ref bufferBytes of the physical buffer the plane is mapped to.
+    int buffer;
+  };
+
+  /// Add a plane that is live from pass \p first to pass \p last.
+  void add(const char *name, size_t bytes, int first, int last);
+
+  /// \brief Map the planes onto physical buffers.
+  ///
+  /// Planes are placed largest first into the first buffer whose planes are all dead
+  /// while they are live, which keeps both the number and the total size of the buffers
+  /// small.
+  void assign();
+
+  /// Total size of the physical buffers.
+  size_t plannedBytes() const;
+
+  /// The largest number of bytes live at the same time, a lower bound of any plan.
+  size_t liveBytes() const;
+
+  std::vector<Plane> planes;
+
+  /// Size of each physical buffer.
+  std::vector<size_t> bufferBytes;
+};
+
+/// MemoryReport - Planned and actual memory footprint of the guided filter.
+class MemoryReport {
+public:
+  /// Total size of the physical buffers of the plan.
+  size_t plannedBytes;
+
+  /// The largest number of bytes live at the same time.
+  size_t liveBytes;
+
+  /// Bytes the filter actually holds, 0 if they were not measured for the requested size.
+  size_t actualBytes;
+
+  /// Size of the image \ref actualBytes were measured for, empty if they were not.
+  cv::Size actualSize;
+};
+
+/// ADFStrength - One smoothing strength of a batch of \ref GuidedFilter::applyADF outputs.
+class ADFStrength {
 public:
-  GFOptions() : eps(300), radius4skin(20) {}
+  /// Scale of \ref GFOptions::radius4skin.
+  float radiusScale;
+
+  /// The epsilon parameter, in place of \ref GFOptions::eps.
+  float eps;
+
+public:
+  ADFStrength(float radiusScale, float eps) : radiusScale(radiusScale), eps(eps) {}
 };
 
 /// \brief Class for Attribute-aware Dynamic Guided Filter.
@@ -28,46 +295,352 @@ public:
 public:
   explicit GuidedFilter(GFOptions op = GFOptions()) : opts(op) {}
 
-  // TODO: support more CV types
-
   /// \brief Blurs a single channel image with dynamic window size(radius).
-  /// \param src [in] Input image(CV_32FC1).
-  /// \param dst [out] Output image of the same size and type as src(CV_32FC1).
+  /// \param src [in] Input image(CV_8UC1 or CV_32FC1), 8-bit images are summed exactly.
+  /// \param dst [out] Output image of the same size as src(CV_32FC1).
   /// \param radius [in] Float-valued matrix contains radius info for each pixel.
   void dynamicMeanFilter(const cv::Mat &src, cv::Mat &dst, const cv::Mat &radius);
 
-  /// \brief Blurs a single channel image with guided filtering.
-  /// \param src [in] Input image.
-  /// \param guidance [in] Guidance color image.
-  /// \param dst [out] Output image of the same size and type as src.
+  /// \brief Blurs a single channel image with a pre-analyzed radius layout.
+  /// \param src [in] Input image(CV_8UC1 or CV_32FC1), 8-bit images are summed exactly.
+  /// \param dst [out] Output image of the same size as src(CV_32FC1).
+  /// \param spans [in] Run-length layout of the radius map.
+  void dynamicMeanFilter(const cv::Mat &src, cv::Mat &dst, const RadiusSpans &spans);
+
+  /// \brief Blurs an image with guided filtering.
+  ///
+  /// The statistics of the guidance image and the inverse of its covariance matrix are
+  /// computed once and shared by all of the channels of \p src. Pixels with a radius of 0
+  /// keep their input values, so only the bounding box of the positive radii, grown by the
+  /// largest radius, is evaluated. 8-bit, 16-bit and float images are read in place if the
+  /// input and the guidance share their depth, other combinations are converted to float.
+  ///
+  /// \param src [in] Input image(1 or 3 channels).
+  /// \param guidance [in] Guidance image(1 or 3 channels), see
+  ///                      \ref GFOptions::grayGuidance.
+  /// \param dst [out] Output image of the same size and channels as src, of depth
+  ///                  \ref GFOptions::outputDepth.
   /// \param radius [in] Float-valued matrix contains radius info for each pixel.
   void dynamicGuidedFilter(const cv::Mat &src, const cv::Mat &guidance, cv::Mat &dst,
                            const cv::Mat &radius, const double eps);
 
+  /// \brief Blurs an image with guided filtering and a per-pixel eps.
+  ///
+  /// eps is read in the same loop that solves for the coefficients of each pixel, so a
+  /// map costs no extra pass over the image compared with a uniform eps.
+  ///
+  /// \param src [in] Input image(1 or 3 channels).
+  /// \param guidance [in] Guidance image(1 or 3 channels), see
+  ///                      \ref GFOptions::grayGuidance.
+  /// \param dst [out] Output image of the same size and channels as src, of depth
+  ///                  \ref GFOptions::outputDepth.
+  /// \param radius [in] Float-valued matrix contains radius info for each pixel.
+  /// \param eps [in] The epsilon parameter of each pixel, of the same size as src.
+  void dynamicGuidedFilter(const cv::Mat &src, const cv::Mat &guidance, cv::Mat &dst,
+                           const cv::Mat &radius, const EpsMap &eps);
+
+  /// \brief Blurs an image with guided filtering at several settings at once.
+  ///
+  /// The product planes of the guidance and the input and their summed-area tables do not
+  /// depend on the radius or eps, so they are built once and the windows of every setting
+  /// read them. Only the coefficients are solved and averaged for each setting. The
+  /// settings share the region that is filtered, the union of their regions(see
+  /// \ref dynamicGuidedFilter), so near its border an output may differ slightly from a
+  /// call with its setting alone. \ref GFOptions::cacheStatistics only applies to a batch
+  /// of one setting.
+  ///
+  /// \param src [in] Input image(1 or 3 channels).
+  /// \param guidance [in] Guidance image(1 or 3 channels), see
+  ///                      \ref GFOptions::grayGuidance.
+  /// \param dsts [out] One output image for each setting, see \ref dynamicGuidedFilter.
+  /// \param radii [in] Radius map of each setting(CV_32FC1).
+  /// \param eps [in] The epsilon parameter of each setting.
+  void dynamicGuidedFilter(const cv::Mat &src, const cv::Mat &guidance,
+                           std::vector<cv::Mat> &dsts, const std::vector<cv::Mat> &radii,
+                           const std::vector<EpsMap> &eps);
+
+  /// \brief Reads the x-th rows of the input image, the guidance image and the radius map.
+  using RowReader =
+      std::function<void(int x, cv::Mat &srcRow, cv::Mat &guideRow, cv::Mat &radiusRow)>;
+
+  /// \brief Receives the x-th row of the output image.
+  using RowWriter = std::function<void(int x, const cv::Mat &dstRow)>;
+
+  /// \brief Blurs an image with guided filtering, streaming it row by row.
+  ///
+  /// Rows are read from top to bottom and each output row is written as soon as it is
+  /// complete, 2 * ceil(maxRadius) rows after the same input row. Only the last
+  /// 2 * ceil(maxRadius) + 2 rows of the summed-area tables of the statistics and of the
+  /// coefficients are kept, so the memory footprint does not depend on the image height.
+  /// The filter always runs at full resolution.
+  ///
+  /// \param size [in] Size of the image.
+  /// \param maxRadius [in] Upper bound of the radius map.
+  /// \param read [in] Reads a row of the input image(1 or 3 channels), the guidance
+  ///                  image(1 or 3 channels) and the radius map(CV_32FC1).
+  /// \param write [in] Receives a row of the output image(CV_32FC1 or CV_32FC3).
+  /// \param eps [in] The epsilon parameter in Guided Filtering.
+  void streamGuidedFilter(cv::Size size, float maxRadius, const RowReader &read,
+                          const RowWriter &write, const double eps);
+
   void checkAndInit(const cv::Mat &src, const cv::Mat &guidance);
 
+  /// \brief Plan the intermediates of \ref dynamicGuidedFilter with the current options.
+  ///
+  /// Assumes the worst case that every pixel has a positive radius, and an 8-bit(or float)
+  /// image. The statistics of 16-bit images take twice as many bytes.
+  ///
+  /// \param size [in] Size of the image.
+  /// \param nChannel [in] Number of channels of the input image.
+  /// \param maxRadius [in] Upper bound of the radius map.
+  /// \param needsIntegral [in] Whether the radius map has more than
+  ///                          \ref RadiusSpans::MaxRunningRadii distinct radii.
+  BufferPlan planBuffers(cv::Size size, int nChannel, float maxRadius,
+                         bool needsIntegral) const;
+
+  /// Drop the cached statistics, see \ref GFOptions::cacheStatistics.
+  void clearStatistics() {
+    statsCache.release();
+    statsCacheKey = 0;
+  }
+
+  /// Bytes of all of the buffers the filter currently holds. They are kept between calls
+  /// on images of the same size, so after a call this is the peak footprint of the
+  /// intermediates of the calls at that size.
+  size_t allocatedBytes() const;
+
+  /// \brief Report the planned footprint for an image and the actual one of the last call.
+  ///
+  /// The actual footprint is only reported if the last call filtered an image of the same
+  /// size, otherwise the report only holds the plan.
+  ///
+  /// \param size [in] Size of the image.
+  /// \param nChannel [in] Number of channels of the input image.
+  /// \param maxRadius [in] Upper bound of the radius map.
+  /// \param needsIntegral [in] See \ref planBuffers.
+  MemoryReport memoryReport(cv::Size size, int nChannel, float maxRadius,
+                            bool needsIntegral = false) const;
+
   /// \brief Blurs a color image with guided filtering.
   /// \param mask [in] Binary mask(CV_8UC1).
   /// \param guidance [in] Guidance Color Image.
   /// \param src [in] Input color image.
-  /// \param dst [out] Output image of the same size and type as src.
+  /// \param dst [out] Output image of the same size as src, of depth
+  ///                  \ref GFOptions::outputDepth.
   void applyADF(const cv::Mat &mask, const cv::Mat &guidance, const cv::Mat &src,
                 cv::Mat &dst);
 
+  /// \brief Blurs a color image with attribute-aware guided filtering.
+  ///
+  /// The radius and eps of each skin pixel are \ref GFOptions::radius4skin times
+  /// \p radiusScale and \ref GFOptions::eps times \p epsScale.
+  ///
+  /// \param mask [in] Binary mask(CV_8UC1).
+  /// \param guidance [in] Guidance Color Image.
+  /// \param src [in] Input color image.
+  /// \param dst [out] Output image of the same size as src, of depth
+  ///                  \ref GFOptions::outputDepth.
+  /// \param radiusScale [in] Per-pixel scale of the radius(CV_32FC1), or empty for 1.
+  /// \param epsScale [in] Per-pixel scale of eps(CV_32FC1), or empty for 1.
+  void applyADF(const cv::Mat &mask, const cv::Mat &guidance, const cv::Mat &src,
+                cv::Mat &dst, const cv::Mat &radiusScale, const cv::Mat &epsScale);
+
+  /// \brief Blurs a color image at several smoothing strengths at once.
+  ///
+  /// Each output equals an \ref applyADF call with \ref GFOptions::radius4skin times the
+  /// radius scale of its strength and with its eps, up to the border of the shared region
+  /// (see the batch \ref dynamicGuidedFilter). In the \ref GFOptions::lumaOnly mode the
+  /// strengths are filtered one after another.
+  ///
+  /// \param mask [in] Binary mask(CV_8UC1).
+  /// \param guidance [in] Guidance Color Image.
+  /// \param src [in] Input color image.
+  /// \param strengths [in] The smoothing strengths.
+  /// \param dsts [out] One output image for each strength, see \ref applyADF.
+  /// \param radiusScale [in] Per-pixel scale of the radius(CV_32FC1), or empty for 1.
+  /// \param epsScale [in] Per-pixel scale of eps(CV_32FC1), or empty for 1.
+  void applyADF(const cv::Mat &mask, const cv::Mat &guidance, const cv::Mat &src,
+                const std::vector<ADFStrength> &strengths, std::vector<cv::Mat> &dsts,
+                const cv::Mat &radiusScale = cv::Mat(),
+                const cv::Mat &epsScale = cv::Mat());
+
 private:
+  /// How a call uses the cached statistics, see \ref GFOptions::cacheStatistics.
+  enum class CacheMode {
+    /// The statistics are neither read from nor written to the cache.
+    Off,
+    /// The statistics are computed and written to the cache.
+    Store,
+    /// The statistics are read from the cache.
+    Load
+  };
+
+  /// \brief Blurs an image with guided filtering at several settings into outputs of
+  /// depth \p ddepth, see the batch \ref dynamicGuidedFilter.
+  /// \param ddepth [in] Depth of \p dsts, CV_8U, CV_16U or CV_32F.
+  void filterBatch(const cv::Mat &src, const cv::Mat &guidance, std::span<cv::Mat> dsts,
+                   std::span<const cv::Mat> radii, std::span<const EpsMap> eps,
+                   const int ddepth);
+
+  /// \brief Blurs a color image at several smoothing strengths, see \ref applyADF.
+  void applyADFBatch(const cv::Mat &mask, const cv::Mat &guidance, const cv::Mat &src,
+                     std::span<const ADFStrength> strengths, std::span<cv::Mat> dsts,
+                     const cv::Mat &radiusScale, const cv::Mat &epsScale);
+
+  /// Depth of the output for the input image \p src, see \ref GFOptions::outputDepth.
+  int outputDepth(const cv::Mat &src) const;
+
+  /// \brief Build the product planes of the input and the guidance into \ref statsImg.
+  /// \param input [in] Input image(1 or 3 channels, CV_8U, CV_16U or CV_32F).
+  /// \param guide [in] Guidance image(1 or 3 channels) of the same depth as \p input.
+  /// \param statsDepth [in] Depth of the product planes, CV_32S if the input and the
+  ///                        guidance are integer-valued(8-bit) so that their statistics are
+  ///                        summed exactly, CV_32F otherwise, or CV_16F to save memory.
+  /// \param spans [in] Layouts of the radius maps that read the planes, the summed-area
+  ///                   table of the planes is built for those that need it.
+  void computeStatistics(const cv::Mat &input, const cv::Mat &guide, const int statsDepth,
+                         std::span<const RadiusSpans> spans);
+
+  /// \brief Solve for the a & b coefficients of every pixel into \ref coefImg.
+  ///
+  /// Reads the product planes of the last \ref computeStatistics call, or the cached
+  /// statistics.
+  ///
+  /// \param spans [in] Layout of the radius map, of the size of the product planes.
+  /// \param nGuide [in] Number of guidance channels, 1 or 3.
+  /// \param nChannel [in] Number of channels of the input image.
+  /// \param eps [in] The epsilon parameter of each pixel in Guided Filtering.
+  /// \param statsDepth [in] Depth of the product planes, see \ref computeStatistics.
+  /// \param fixedPoint [in] Whether to solve for fixed-point coefficients(CV_32S), which
+  ///                        needs CV_32S statistics and no cache, see
+  ///                        \ref GFOptions::outputDepth.
+  /// \param cache [in] How the centered statistics are cached, see \ref statsCache.
+  void computeCoefficients(const RadiusSpans &spans, const int nGuide, const int nChannel,
+                           const EpsMap &eps, const int statsDepth, const bool fixedPoint,
+                           const CacheMode cache);
+
+  /// \brief Run the full resolution guided filter on a region of the image.
+  /// \param input [in] Input image of the region, see \ref computeStatistics.
+  /// \param guide [in] Guidance image of the region, see \ref computeStatistics.
+  /// \param radii [in] Radius map of the region for each setting(CV_32FC1).
+  /// \param outputs [in,out] Output image of the region for each setting(CV_8U, CV_16U or
+  ///                        CV_32F), only \p core is written.
+  /// \param core [in] The part of the region whose windows lie inside the region.
+  /// \param eps [in] The epsilon parameter of each pixel of the region for each setting.
+  /// \param statsDepth [in] Depth of the product planes, see \ref computeStatistics.
+  /// \param fixedPoint [in] Whether to run in fixed point into CV_8U outputs, see
+  ///                        \ref computeCoefficients.
+  /// \param cache [in] How the statistics are cached, see \ref computeCoefficients.
+  void filterRegion(const cv::Mat &input, const cv::Mat &guide,
+                    std::span<const cv::Mat> radii, std::span<cv::Mat> outputs,
+                    const cv::Rect &core, std::span<const EpsMap> eps,
+                    const int statsDepth, const bool fixedPoint, const CacheMode cache);
+
+  /// \brief Filter the luminance of a color image, see \ref GFOptions::lumaOnly.
+  /// \param guidance [in] Guidance Color Image.
+  /// \param src [in] Input color image.
+  /// \param dst [out] Output image of depth \ref GFOptions::outputDepth.
+  /// \param radius [in] Float-valued matrix contains radius info for each pixel.
+  /// \param eps [in] The epsilon parameter of each pixel.
+  /// \param chromaRadius [in] Radius of the chroma smoothing at full resolution.
+  void applyLumaADF(const cv::Mat &guidance, const cv::Mat &src, cv::Mat &dst,
+                    const cv::Mat &radius, const EpsMap &eps, const float chromaRadius);
+
+  /// \brief Plan the intermediate planes of a call.
+  /// \param size [in] Size of the image.
+  /// \param roi [in] Size of the region that is filtered.
+  /// \param nGuide [in] Number of guidance channels, 1 or 3.
+  /// \param nChannel [in] Number of channels of the input image.
+  /// \param depth [in] Depth the input and the guidance are read at.
+  /// \param maxRadius [in] Upper bound of the radius map.
+  /// \param needsIntegral [in] See \ref planBuffers.
+  /// \param keepStatistics [in] Whether the product planes are read until the last pass,
+  ///                            by a batch of several settings.
+  BufferPlan planBuffers(cv::Size size, cv::Size roi, int nGuide, int nChannel, int depth,
+                         float maxRadius, bool needsIntegral, bool keepStatistics) const;
+
+  /// \brief Side length of the tiles of a call, see \ref GFOptions::tileBudget.
+  ///
+  /// The whole region is a single tile if it is not tiled.
+  ///
+  /// \param roi [in] Size of the region that is filtered.
+  /// \param nGuide [in] Number of guidance channels, 1 or 3.
+  /// \param nChannel [in] Number of channels of the input image.
+  /// \param depth [in] Depth the input and the guidance are read at.
+  /// \param maxRadius [in] Upper bound of the radius map.
+  /// \param needsIntegral [in] See \ref planBuffers.
+  int tileSizeFor(cv::Size roi, int nGuide, int nChannel, int depth, float maxRadius,
+                  bool needsIntegral) const;
+
+  /// Number of guidance channels the filter uses for \p guidance, see
+  /// \ref GFOptions::grayGuidance.
+  int guideChannels(const cv::Mat &guidance) const {
+    return opts.grayGuidance ? 1 : guidance.channels();
+  }
+
+  /// Member image bound to the plane \p plane of \ref bufferPlan.
+  cv::Mat &planeImg(int plane);
+
+  /// \brief Make \p m a plane of \ref bufferPlan, backed by its physical buffer.
+  ///
+  /// The buffer grows as needed. Planes that share it are dead by then, so this never
+  /// invalidates a live plane, but their images are released rather than left pointing
+  /// at the freed storage. Without a plan \p m is allocated on its own.
+  ///
+  /// \param m [out] The plane.
+  /// \param plane [in] Index of the plane in the plan.
+  /// \param size [in] Size of the plane.
+  /// \param type [in] Type of the plane.
+  void bindPlane(cv::Mat &m, int plane, cv::Size size, int type);
+
+  /// Mapping of the intermediate planes of the current call onto \ref buffers.
+  BufferPlan bufferPlan;
+
+  /// Physical buffers backing the planes of \ref bufferPlan(CV_8UC1).
+  std::vector<cv::Mat> buffers;
+
+  /// Size of the image of the last call, which \ref buffers are sized for.
+  cv::Size buffersSize;
+
   cv::Mat inputImg;
   cv::Mat guideImg;
   cv::Mat workImg;
-  cv::Mat radiusImg;
-  std::array<cv::Mat, 3> inputChannels;
-  std::array<cv::Mat, 3> outputChannels;
-  cv::Mat meanP;
-  std::array<cv::Mat, 3> IChannels;
-  std::array<cv::Mat, 3> meanIChannels;
-  std::array<cv::Mat, 3> meanIpChannels;
-  std::array<cv::Mat, 3> covIpChannels;
-  cv::Mat var00, var01, var02, var11, var12, var22;
-  std::array<cv::Mat, 3> aChannels;
+  RadiusSpans radiusSpans;
+
+  /// Radius and eps maps of each strength of \ref applyADF.
+  std::vector<cv::Mat> radiusImgs;
+  std::vector<cv::Mat> epsImgs;
+
+  /// Layout of the radius map of each setting of the current region.
+  std::vector<RadiusSpans> batchSpans;
+
+  /// Interleaved product planes of the guidance and the input image.
+  cv::Mat statsImg;
+  cv::Mat statsIntegral;
+
+  /// Interleaved a & b coefficients.
+  cv::Mat coefImg;
+  cv::Mat coefIntegral;
+
+  /// Centered windowed statistics of the last cached call, one run of columns per
+  /// statistic in each row(CV_32FC1), and the hash of its inputs.
+  cv::Mat statsCache;
+  uint64_t statsCacheKey = 0;
+
+  /// Subsampled copies and the upsampled mean coefficients of the fast guided filter.
+  cv::Mat inputImgDn;
+  cv::Mat guideImgDn;
+  cv::Mat radiusImgDn;
+  cv::Mat epsImgDn;
+  cv::Mat meanCoefImg;
+  cv::Mat meanCoefUpImg;
+
+  /// Color planes of the luma-only mode.
+  cv::Mat colorImg;
+  cv::Mat lumaImg;
+  cv::Mat lumaOutImg;
+  cv::Mat chromaImg;
+  cv::Mat chromaDnImg;
 };
 
 } // namespace fabsoften
@@ -0,0 +1,58 @@
+#ifndef RECURSIVE_GAUSSIAN_H
+#define RECURSIVE_GAUSSIAN_H
+
+#include <array>
+#include <opencv2/imgproc.hpp>
+
+namespace fabsoften {
+
+/// \brief Third-order recursive approximation of the Gaussian(Young & van Vliet).
+///
+/// A causal and an anti-causal pass of 3 taps each replace the convolution, so the cost
+/// per pixel does not depend on the standard deviation. The border is replicated as
+/// `cv::BORDER_REPLICATE`, the anti-causal pass starts from the response to the last
+/// sample repeated indefinitely(Triggs & Sdika).
+class RecursiveGaussian {
+public:
+  /// Smallest standard deviation the approximation holds for, smaller ones fall back to
+  /// `cv::GaussianBlur`.
+  static constexpr double MinSigma = 0.5;
+
+public:
+  /// \param sigma [in] Standard deviation in pixels, at least \ref MinSigma.
+  explicit RecursiveGaussian(double sigma);
+
+  /// Filter \p n contiguous samples in place.
+  void filter(double *line, int n) const;
+
+  /// Filter the columns [\p begin, \p end) of a CV_32FC1 image in place.
+  void filterColumns(cv::Mat &plane, int begin, int end) const;
+
+  /// \brief Blur an image, as `cv::GaussianBlur` with a (0, 0) kernel size.
+  ///
+  /// \param src [in] Input image(CV_8UC1 or CV_32FC1).
+  /// \param dst [out] Output image of the same size and type as \p src.
+  /// \param sigmaX [in] Standard deviation along the rows.
+  /// \param sigmaY [in] Standard deviation along the columns.
+  static void blur(const cv::Mat &src, cv::Mat &dst, double sigmaX, double sigmaY);
+
+  /// Standard deviation `cv::getGaussianKernel` picks for an odd kernel size.
+  static double blockSigma(int blockSize) {
+    return 0.3 * ((blockSize - 1) * 0.5 - 1) + 0.8;
+  }
+
+private:
+  /// Gain of the input sample.
+  double b;
+
+  /// Feedback coefficients of the previous 3 outputs.
+  std::array<double, 3> a;
+
+  /// Maps the last 3 causal outputs to the first 3 anti-causal ones, both relative to the
+  /// last input sample.
+  std::array<std::array<double, 3>, 3> m;
+};
+
+} // namespace fabsoften
+
+#endif
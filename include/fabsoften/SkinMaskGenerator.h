@@ -35,11 +35,21 @@ public:
   /// Control the size of the morph element
   unsigned int ErodingSize;
 
+  /// Downsampling factor of the grid the soft mask is eroded and feathered on
+  unsigned int featherScale;
+
+  /// Radius of the guided feathering as a fraction of the shorter side of the image
+  float featherRadiusRate;
+
+  /// Regularization of the guided feathering, in squared normalized intensities
+  float featherEps;
+
 public:
   SkinMaskOptions()
       : EnableFace(true), EnableMouth(true), EnableEye(true), EnableEyeBrow(true),
         EnableCheek(false), faceScaleRate(0.85f), BrowOffsetRate(0.01),
-        BrowThicknessRate(0.02), ErodingSize(71) {}
+        BrowThicknessRate(0.02), ErodingSize(71), featherScale(4), featherRadiusRate(0.02f),
+        featherEps(1e-4f) {}
 };
 
 /// \brief Class for generating skin masks.
@@ -65,10 +75,33 @@ public:
   /// \param [out] dstMask A single channel mask of eltype `CV_8UC1`.
   void generateBinaryMask(Face &face, cv::Mat dstMask);
 
+  /// \brief Generate a soft mask by guided feathering
+  ///
+  /// The regions of \ref generateBinaryMask are eroded on a grid \ref
+  /// SkinMaskOptions::featherScale times coarser than the image, then refined into an
+  /// alpha that follows the edges of \p guidance with a gray-guided filter. The filter
+  /// coefficients are upsampled and applied to the full-resolution guidance.
+  ///
+  /// \param [in] face The face object.
+  /// \param [in] guidance Guidance color image(CV_8UC3) of the same size as \p dstMask.
+  /// \param [out] dstMask A single channel alpha of eltype `CV_8UC1`.
+  void generateSoftMask(Face &face, const cv::Mat &guidance, cv::Mat dstMask);
+
   void copyCurrentMaskTo(cv::Mat &mask) const { maskCur.copyTo(mask); }
 
 private:
+  /// Draw the regions enabled by \ref SkinMaskOptions into \ref maskCur.
+  void drawRegions(Face &face, cv::Size size);
+
   cv::Mat maskCur;
+  cv::Mat maskDn;
+  cv::Mat guideImg;
+  cv::Mat guideDn;
+  cv::Mat meanI;
+  cv::Mat meanP;
+  cv::Mat covIP;
+  cv::Mat varI;
+  cv::Mat workImg;
 };
 
 } // namespace fabsoften
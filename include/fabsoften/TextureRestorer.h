@@ -0,0 +1,66 @@
+#ifndef TEXTURE_RESTORER_H
+#define TEXTURE_RESTORER_H
+
+#include <opencv2/imgproc.hpp>
+
+namespace fabsoften {
+
+/// TextureRestorationOptions - Options for controlling how much skin texture is restored.
+class TextureRestorationOptions {
+public:
+  /// Fraction of the detail layer that is added back onto the smoothed skin. 0 keeps the
+  /// smoothed skin as is, 1 restores all of the detail of the finest \ref levels octaves.
+  float strength;
+
+  /// \brief Number of octaves the detail layer spans.
+  ///
+  /// The detail layer is the difference between the image and its Laplacian pyramid
+  /// collapsed without the finest \p levels bands, i.e. pores and fine wrinkles at 1,
+  /// coarser texture as well at 2.
+  int levels;
+
+public:
+  TextureRestorationOptions() : strength(0.35f), levels(1) {}
+};
+
+/// \brief Class for restoring the fine texture of the smoothed skin.
+///
+/// The smoothing only has to produce a plausible base layer, so it can run on a
+/// subsampled image(see \ref GFOptions::subsample). The high-frequency detail it drops is
+/// then taken from the full-resolution image and partially added back.
+class TextureRestorer {
+public:
+  TextureRestorationOptions opts;
+
+public:
+  explicit TextureRestorer(TextureRestorationOptions op = TextureRestorationOptions())
+      : opts(op) {}
+
+  /// \brief Extract the high-frequency detail layer of an image.
+  ///
+  /// \param src [in] Input image(CV_8UC3). e.g. the `workImg` of \ref Beautifier after
+  ///                 the blemishes are concealed, so that they are not restored.
+  void extractDetail(const cv::Mat &src);
+
+  /// \brief Add the detail layer back onto the smoothed skin.
+  ///
+  /// \param mask [in] Skin mask(CV_8UC1), the detail is weighted by `mask / 255`. Empty
+  ///                 to restore it everywhere, e.g. when the result is blended by the
+  ///                 mask afterwards.
+  /// \param smoothed [in] Smoothed image of the same size as the detail layer, read as is
+  ///                     if it is CV_8UC3 or CV_32FC3.
+  /// \param dst [out] Output image(CV_8UC3).
+  void restore(const cv::Mat &mask, const cv::Mat &smoothed, cv::Mat &dst);
+
+  /// The detail layer of the last \ref extractDetail call(CV_16SC3).
+  const cv::Mat &getDetail() const { return detailImg; }
+
+private:
+  cv::Mat baseImg;
+  cv::Mat detailImg;
+  cv::Mat smoothedImg;
+};
+
+} // namespace fabsoften
+
+#endif
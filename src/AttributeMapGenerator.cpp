@@ -0,0 +1,69 @@
+/// \file AttributeMapGenerator.cpp
+/// \brief AttributeMapGenerator Implmentation
+///
+
+#include "fabsoften/AttributeMapGenerator.h"
+
+using namespace fabsoften;
+
+void AttributeMapGenerator::generate(const cv::Mat &src,
+                                     const std::vector<std::vector<cv::Point>> &blemishes) {
+  CV_Assert(src.type() == CV_8UC3 && opts.gridScale >= 1 && opts.radiusLevels >= 3);
+
+  // Estimate the attributes on a coarse grid
+  const auto gridSize = cv::Size((src.cols + opts.gridScale - 1) / opts.gridScale,
+                                 (src.rows + opts.gridScale - 1) / opts.gridScale);
+  cv::resize(src, workImg, gridSize, 0, 0, cv::INTER_AREA);
+  cv::cvtColor(workImg, grayImg, cv::COLOR_BGR2GRAY);
+  grayImg.convertTo(grayImg, CV_32F);
+
+  const auto shorterSide = std::min(gridSize.width, gridSize.height);
+  const int N = 2 * cvRound(shorterSide * opts.windowRate / 2) + 1;
+  const auto window = cv::Size(N, N);
+
+  // Texture: the standard deviation of the gray levels in the neighborhood
+  cv::boxFilter(grayImg, textureImg, CV_32F, window);
+  cv::multiply(grayImg, grayImg, workImg);
+  cv::boxFilter(workImg, workImg, CV_32F, window);
+  cv::multiply(textureImg, textureImg, textureImg);
+  cv::subtract(workImg, textureImg, textureImg);
+  cv::max(textureImg, 0.0, textureImg);
+  cv::sqrt(textureImg, textureImg);
+  textureImg.convertTo(textureImg, CV_32F, 1.0 / opts.textureSaturation);
+  cv::min(textureImg, 1.0, textureImg);
+
+  // Density: the fraction of blemish pixels in the neighborhood. Blemishes are a few
+  // pixels wide, so their areas are splatted onto the grid cells of their centers rather
+  // than drawn at the coarse resolution.
+  densityImg = cv::Mat::zeros(gridSize, CV_32FC1);
+  const auto cellArea = static_cast<double>(opts.gridScale) * opts.gridScale;
+  for (const auto &contour : blemishes) {
+    const auto box = cv::boundingRect(contour);
+    const auto x = std::min((box.y + box.height / 2) / opts.gridScale, gridSize.height - 1);
+    const auto y = std::min((box.x + box.width / 2) / opts.gridScale, gridSize.width - 1);
+    densityImg.at<float>(x, y) += static_cast<float>(cv::contourArea(contour) / cellArea);
+  }
+  cv::boxFilter(densityImg, densityImg, CV_32F, window);
+  densityImg.convertTo(densityImg, CV_32F, 1.0 / opts.densitySaturation);
+  cv::min(densityImg, 1.0, densityImg);
+
+  // Blemishes call for stronger smoothing, textured skin for weaker smoothing
+  textureImg.convertTo(textureImg, CV_32F, -opts.textureDamping, 1);
+  densityImg.convertTo(workImg, CV_32F, opts.radiusDensityGain, 1);
+  cv::multiply(workImg, textureImg, workImg);
+  cv::resize(workImg, radiusScale, src.size(), 0, 0, cv::INTER_LINEAR);
+  densityImg.convertTo(workImg, CV_32F, opts.epsDensityGain, 1);
+  cv::multiply(workImg, textureImg, workImg);
+  cv::resize(workImg, epsScale, src.size(), 0, 0, cv::INTER_LINEAR);
+
+  // Quantize the radius scale around 1, the filter handles a few distinct radii much
+  // faster. The scales lie in [lo, hi], so they round to at most radiusLevels steps.
+  const auto lo = 1 - opts.textureDamping;
+  const auto hi = 1 + opts.radiusDensityGain;
+  if (hi > lo) {
+    const auto step = (hi - lo) / (opts.radiusLevels - 2);
+    constexpr auto offset = 128;
+    radiusScale.convertTo(workImg, CV_8U, 1.0 / step, offset - 1.0 / step);
+    workImg.convertTo(radiusScale, CV_32F, step, 1 - offset * step);
+  }
+}
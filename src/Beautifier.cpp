@@ -3,6 +3,7 @@
 ///
 
 #include "fabsoften/Beautifier.h"
+#include <algorithm>
 #include <opencv2/imgcodecs.hpp>
 #include <opencv2/imgproc.hpp>
 #include <ranges>
@@ -13,7 +14,10 @@ Beautifier::Beautifier(const std::string inputImgPath, const std::string landmar
     : imgPath(inputImgPath), modelPath(landmarkModelPath),
       curveFitVis(std::make_unique<CurveFittingVisitor>()),
       maskGen(std::make_unique<SkinMaskGenerator>()),
-      blemishRM(std::make_unique<BlemishRemover>()), gf(std::make_unique<GuidedFilter>()) {
+      blemishRM(std::make_unique<BlemishRemover>()),
+      attrMapGen(std::make_unique<AttributeMapGenerator>()),
+      gf(std::make_unique<GuidedFilter>()),
+      textureRS(std::make_unique<TextureRestorer>()) {
   inputImg = cv::imread(inputImgPath);
   assert(!inputImg.empty() && "Could not load image!");
   workImg = inputImg.clone();
@@ -31,22 +35,34 @@ void Beautifier::soften() {
   if (maskImg.size() != workImg.size())
     maskImg = cv::Mat::zeros(workImg.size(), CV_8UC1);
 
-  drawBinaryMask(maskImg);
-
-  cv::Mat maskChannels[3] = {maskImg, maskImg, maskImg};
-  cv::merge(maskChannels, 3, maskImg3C);
-
-  cv::bitwise_not(maskImg3C, /*mask=*/tmpImg);
-  cv::bitwise_and(workImg, /*mask=*/tmpImg, /*background=*/tmpImg);
+  // Feather the mask before blemish concealment so it follows the edges of the input
+  drawSoftMask(maskImg);
   workImg.copyTo(tmpImg2);
 
   concealBlemish(maskImg);
+  generateAttributeMaps();
+
+  // The fine texture is restored after the smoothing, so the filter only has to produce
+  // the base layer and can run at half resolution. It is written in 8-bit, which the
+  // restoration reads as is. The options of the other callers of the filter are kept.
+  const auto gfOpts = gf->opts;
+  gf->opts.subsample = std::max(gfOpts.subsample, 2);
+  gf->opts.outputDepth = CV_8U;
+
+  // Anything touched outside the mask is discarded by the final composite
+  applyAttributeAwareADF(maskImg, workImg, /*original image=*/tmpImg2, tmpImg);
+  gf->opts = gfOpts;
+
+  // The composite already weights the restored skin by the mask
+  restoreTexture(/*mask=*/cv::Mat(), /*smoothed image=*/tmpImg, tmpImg);
+  composite(maskImg, tmpImg, /*original image=*/tmpImg2, outputImg);
+}
 
-  cv::bitwise_and(workImg, maskImg3C, workImg);
-  cv::add(workImg, tmpImg, workImg);
-
-  applyADF(maskImg, workImg, /*original image=*/tmpImg2, tmpImg);
-  tmpImg.convertTo(outputImg, CV_8U);
+void Beautifier::composite(const cv::Mat &mask, const cv::Mat &src,
+                           const cv::Mat &background, cv::Mat &dst) {
+  mask.convertTo(alphaImg, CV_32F, 1.0 / 255);
+  alphaImg.convertTo(alphaImg2, CV_32F, -1, 1);
+  cv::blendLinear(src, background, alphaImg, alphaImg2, dst);
 }
 
 void Beautifier::downsampling() { cv::pyrDown(workImg, workImg); }
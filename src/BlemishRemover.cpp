@@ -3,36 +3,103 @@
 ///
 
 #include "fabsoften/BlemishRemover.h"
+#include "fabsoften/RecursiveGaussian.h"
+#include <algorithm>
+#include <iterator>
 #include <ranges>
 
 using namespace fabsoften;
 
+namespace {
+/// Standard deviation of the Gaussian before the Canny edge detection.
+constexpr double CannySigma = 3;
+
+/// Run \p fn on every tile of an image of size \p size, in parallel, along with the tile
+/// grown by \p halo and clipped to the image.
+template <typename Fn>
+void forEachTile(cv::Size size, int tileSize, int halo, const Fn &fn) {
+  if (tileSize <= 0)
+    tileSize = std::max(size.width, size.height);
+  const auto bounds = cv::Rect(0, 0, size.width, size.height);
+  const auto nTileCol = (size.width + tileSize - 1) / tileSize;
+  const auto nTileRow = (size.height + tileSize - 1) / tileSize;
+  cv::parallel_for_(cv::Range(0, nTileRow * nTileCol), [&](const cv::Range &tiles) {
+    for (int i = tiles.start; i < tiles.end; ++i) {
+      const auto tx = i % nTileCol * tileSize, ty = i / nTileCol * tileSize;
+      const auto core = cv::Rect(tx, ty, tileSize, tileSize) & bounds;
+      const auto region = cv::Rect(core.x - halo, core.y - halo, core.width + 2 * halo,
+                                   core.height + 2 * halo) &
+                          bounds;
+      fn(core, region);
+    }
+  });
+}
+} // namespace
+
 void BlemishRemover::computeDoG(const cv::Mat &src, const cv::Mat &mask) {
+  CV_Assert(mask.type() == CV_8UC1 && mask.size() == src.size());
+
   // Convert the RGB image to a single channel gray image
   cv::cvtColor(src, grayImg, cv::COLOR_BGR2GRAY);
 
-  // Compute the DoG to detect edges
+  // Compute the DoG to detect edges, the coarse Gaussian grows with the image so it is
+  // recursive to keep its cost per pixel constant
   const auto sigmaY = grayImg.cols / 200.0;
   const auto sigmaX = grayImg.rows / 200.0;
-  cv::GaussianBlur(grayImg, workImg, cv::Size(3, 3), /*sigma=*/0);
-  cv::GaussianBlur(grayImg, workImg2, cv::Size(0, 0), sigmaX, sigmaY);
-  cv::subtract(workImg2, workImg, workImg);
-
-  // Apply binary mask to the image
-  cv::bitwise_and(mask, workImg, workImg2);
-
-  // Discard uniform skin regions
-  const int N = 2 * (std::min(workImg.cols, workImg.rows) / 50) + 1;
-  cv::adaptiveThreshold(workImg2, workImg, /*maxValue=*/255, cv::ADAPTIVE_THRESH_GAUSSIAN_C,
-                        cv::THRESH_BINARY, /*blockSize=*/N, 0);
-  // Eroding
-  cv::Mat element = cv::getStructuringElement(cv::MORPH_ELLIPSE, cv::Size(7, 7));
-  cv::morphologyEx(workImg, workImg, cv::MORPH_ERODE, element);
+  RecursiveGaussian::blur(grayImg, workImg2, sigmaX, sigmaY);
+
+  // The fine Gaussian is fused with the difference and the mask, any nonzero pixel of a
+  // soft mask counts
+  dogImg.create(grayImg.size(), CV_8UC1);
+  const auto fuseDoG = [&](cv::Rect core, cv::Rect region) {
+    cv::Mat fineImg;
+    cv::GaussianBlur(grayImg(region), fineImg, cv::Size(3, 3), /*sigma=*/0);
+    const auto inner = core - region.tl();
+    for (int x = 0; x < core.height; ++x) {
+      const auto cRow = workImg2.ptr<uchar>(core.y + x) + core.x;
+      const auto fRow = fineImg.ptr<uchar>(inner.y + x) + inner.x;
+      const auto mRow = mask.ptr<uchar>(core.y + x) + core.x;
+      auto dRow = dogImg.ptr<uchar>(core.y + x) + core.x;
+      for (int y = 0; y < core.width; ++y)
+        dRow[y] = mRow[y] ? cv::saturate_cast<uchar>(cRow[y] - fRow[y]) : 0;
+    }
+  };
+  forEachTile(grayImg.size(), opts.tileSize, /*halo=*/1, fuseDoG);
+
+  // Discard uniform skin regions, the Gaussian-weighted local mean of the DoG is recursive
+  // as well
+  const int N = 2 * (std::min(grayImg.cols, grayImg.rows) / 50) + 1;
+  const auto sigma = RecursiveGaussian::blockSigma(N);
+  RecursiveGaussian::blur(dogImg, workImg2, sigma, sigma);
+
+  // Threshold, erode and smooth for the edge detection one tile at a time. The erosion
+  // reads 3 pixels around and the Gaussian the kernel radius on top, only the smoothed
+  // map is written out.
+  const auto element = cv::getStructuringElement(cv::MORPH_ELLIPSE, cv::Size(7, 7));
+  const auto blurSize = cvRound(CannySigma * 3 * 2 + 1) | 1;
+  const auto halo = element.rows / 2 + blurSize / 2;
+  workImg.create(grayImg.size(), CV_8UC1);
+  const auto fuseEdgeInput = [&](cv::Rect core, cv::Rect region) {
+    cv::Mat binaryImg(region.size(), CV_8UC1);
+    for (int x = 0; x < region.height; ++x) {
+      const auto dRow = dogImg.ptr<uchar>(region.y + x) + region.x;
+      const auto mRow = workImg2.ptr<uchar>(region.y + x) + region.x;
+      auto bRow = binaryImg.ptr<uchar>(x);
+      for (int y = 0; y < region.width; ++y)
+        bRow[y] = dRow[y] > mRow[y] ? 255 : 0;
+    }
+    // Eroding
+    cv::morphologyEx(binaryImg, binaryImg, cv::MORPH_ERODE, element);
+    cv::GaussianBlur(binaryImg, binaryImg, cv::Size(blurSize, blurSize), CannySigma);
+
+    auto dst = workImg(core);
+    binaryImg(core - region.tl()).copyTo(dst);
+  };
+  forEachTile(grayImg.size(), opts.tileSize, halo, fuseEdgeInput);
 }
 
 void BlemishRemover::runCannyEdgeDetection() {
-  // Apply Canny Edge Detection
-  cv::GaussianBlur(workImg, workImg, cv::Size(0, 0), /*sigma=*/3);
+  // Apply Canny Edge Detection, `workImg` is already smoothed by `computeDoG`
   cv::Canny(workImg, workImg2, /*threshold1=*/0, /*threshold2=*/10000,
             /*apertureSize=*/7,
             /*L2gradient=*/false);
@@ -49,13 +116,21 @@ void BlemishRemover::runCannyEdgeDetection() {
                    cv::CHAIN_APPROX_SIMPLE);
 }
 
-void BlemishRemover::removeBlemishes(const cv::Mat &src, cv::Mat &dst) {
+bool BlemishRemover::isBlemish(const std::vector<cv::Point> &contour) {
   constexpr auto ignoreThreshold = 30;
   constexpr auto traversalDepth = 10 * ignoreThreshold;
-  const auto isBlemish = [](const auto &contour) {
-    const auto len = cv::arcLength(contour, /*closed=*/true);
-    return len < traversalDepth && len > ignoreThreshold;
-  };
+  const auto len = cv::arcLength(contour, /*closed=*/true);
+  return len < traversalDepth && len > ignoreThreshold;
+}
+
+std::vector<std::vector<cv::Point>> BlemishRemover::getBlemishes() const {
+  std::vector<std::vector<cv::Point>> blemishes;
+  std::ranges::copy(contours | std::views::filter(isBlemish),
+                    std::back_inserter(blemishes));
+  return blemishes;
+}
+
+void BlemishRemover::removeBlemishes(const cv::Mat &src, cv::Mat &dst) {
   for (const auto &contour : contours | std::views::filter(isBlemish)) {
     float b = 0.0, g = 0.0, r = 0.0;
     for (const auto &pt : contour) {
@@ -3,194 +3,2261 @@
 ///
 
 #include "fabsoften/GuidedFilter.h"
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <numeric>
+#include <type_traits>
+#include <opencv2/core/hal/intrin.hpp>
 
 using namespace fabsoften;
 
+void RadiusSpans::analyze(const cv::Mat &radius) {
+  CV_Assert(radius.type() == CV_32FC1);
+  size = radius.size();
+  spans.clear();
+  rowStarts.assign(1, 0);
+  radii.clear();
+  needsIntegral = false;
+  maxRadius = 0;
+  for (int x = 0; x < radius.rows; ++x) {
+    const auto rRow = radius.ptr<float>(x);
+    for (int y = 0; y < radius.cols;) {
+      const auto r = rRow[y];
+      auto end = y + 1;
+      while (end < radius.cols && rRow[end] == r)
+        ++end;
+      spans.push_back({y, end, r, slotOf(r)});
+      maxRadius = std::max(maxRadius, r);
+      y = end;
+    }
+    rowStarts.push_back(spans.size());
+  }
+
+  // A window spans at most `2 * ceil(r) + 1` pixels in each direction
+  invWidths.resize(2 * cvCeil(maxRadius) + 2);
+  invWidths[0] = 0;
+  for (size_t n = 1; n < invWidths.size(); ++n)
+    invWidths[n] = 1.0 / static_cast<double>(n);
+}
+
+int RadiusSpans::slotOf(float r) {
+  if (r == 0)
+    return RadiusSpan::Identity;
+
+  if (r > 0) {
+    const auto it = std::ranges::find(radii, r);
+    if (it != radii.end())
+      return static_cast<int>(it - radii.begin());
+    if (radii.size() < MaxRunningRadii) {
+      radii.push_back(r);
+      return static_cast<int>(radii.size() - 1);
+    }
+  }
+
+  needsIntegral = true;
+  return RadiusSpan::Integral;
+}
+
+// The layouts below depend on the number of guidance channels G, 3 for color guidance and
+// 1 for gray guidance. The kernels are instantiated for both.
+
+// Channel layout of the statistics plane: the guidance I, the upper triangle of I * I^T
+// (00, 01, 02, 11, 12, 22 for color guidance), then p and I * p of each input channel.
+static constexpr int StatI = 0;
+template <int G> static constexpr int StatII = G;
+template <int G> static constexpr int StatInput = G + G * (G + 1) / 2;
+static constexpr int StatP = 0;
+static constexpr int StatIp = 1;
+template <int G> static constexpr int StatsPerInput = 1 + G;
+static constexpr int MaxStats = StatInput<3> + 3 * StatsPerInput<3>;
+
+// Channel layout of the coefficient plane: a0, a1, a2(a0 only for gray guidance) and b of
+// each input channel.
+static constexpr int CoefA = 0;
+template <int G> static constexpr int CoefB = G;
+template <int G> static constexpr int CoefsPerInput = G + 1;
+
+/// Number of channels of the statistics plane.
+static int statCount(int nGuide, int nChannel) {
+  return nGuide == 1 ? StatInput<1> + StatsPerInput<1> * nChannel
+                     : StatInput<3> + StatsPerInput<3> * nChannel;
+}
+
+/// Number of channels of the coefficient plane.
+static int coefCount(int nGuide, int nChannel) {
+  return (nGuide == 1 ? CoefsPerInput<1> : CoefsPerInput<3>) * nChannel;
+}
+
+// The coefficients are snapped to multiples of 1 / CoefScale, which makes their window sums
+// exact in double precision and therefore independent of the order of summation, e.g. of
+// how the image is split into tiles or row stripes.
+static constexpr float CoefScale = 0x1p20f;
+
+// The fixed-point path of 8-bit images keeps a in 1 / 2^FixedFracA and b in
+// 1 / 2^FixedFracB units(CV_32S). |a| is saturated below 2^8 and |b| below 2^18, so that
+// the window sums of a coefficient plane of up to MaxFixedPixels pixels stay exact in a
+// double summed-area table.
+static constexpr int FixedFracA = 16;
+static constexpr int FixedFracB = 8;
+static constexpr int64_t FixedMaxA = (int64_t(1) << 24) - 1;
+static constexpr int64_t FixedMaxB = (int64_t(1) << 26) - 1;
+static constexpr int MaxFixedPixels = 1 << 27;
+
+// Significant bits the color guidance Sigma of the fixed-point path is rounded to, which
+// keeps its adjugate and determinant within 64 bits
+static constexpr int FixedSigmaBits = 19;
+
+// Side length of the smallest tile derived from \ref GFOptions::tileBudget
+static constexpr int MinTileSize = 16;
+
+#if CV_SIMD
+// Rows of the solver are padded to a multiple of the vector width, so that every pixel is
+// solved by the same code path no matter where a tile starts.
+static constexpr int SolveAlign = cv::v_float32::nlanes;
+#else
+static constexpr int SolveAlign = 1;
+#endif
+
+// Row layout of the centered statistics fed to \ref solveCoefficientsRow, one row for each
+// statistic: the upper triangle of Sigma(the variance of I for gray guidance), the mean of
+// I, then cov(I, p) and the mean of p of each input channel.
+static constexpr int RowSigma = 0;
+template <int G> static constexpr int RowMeanI = G * (G + 1) / 2;
+template <int G> static constexpr int RowInput = RowMeanI<G> + G;
+static constexpr int RowCov = 0;
+template <int G> static constexpr int RowMeanP = G;
+template <int G> static constexpr int RowsPerInput = G + 1;
+
+// Passes of the guided filter, which delimit the live ranges of its intermediate planes
+enum Pass {
+  PassInit,
+  PassDownsample,
+  PassStats,
+  PassSolve,
+  PassCoefIntegral,
+  PassMeans,
+  PassCombine
+};
+
+// Intermediate planes of the guided filter, in the order they are added to its plan
+enum PlaneId {
+  PlaneInput,
+  PlaneGuide,
+  PlaneInputDn,
+  PlaneGuideDn,
+  PlaneRadiusDn,
+  PlaneEpsDn,
+  PlaneStats,
+  PlaneStatsIntegral,
+  PlaneCoef,
+  PlaneCoefIntegral,
+  PlaneMeanCoef,
+  PlaneMeanCoefUp
+};
+
+/// \brief Snap a coefficient to a multiple of 1 / \ref CoefScale.
+static float snapCoefficient(float v) {
+  const auto scaled = v * CoefScale;
+  // Larger values are already integral
+  return std::abs(scaled) < 0x1p23f ? std::nearbyint(scaled) * (1.f / CoefScale) : v;
+}
+
+#if CV_SIMD
+static cv::v_float32 snapCoefficient(const cv::v_float32 &v) {
+  const auto scaled = v * cv::vx_setall_f32(CoefScale);
+  const auto snapped =
+      cv::v_cvt_f32(cv::v_round(scaled)) * cv::vx_setall_f32(1.f / CoefScale);
+  return cv::v_select(cv::v_abs(scaled) < cv::vx_setall_f32(0x1p23f), snapped, v);
+}
+#endif
+
+/// \brief Solve for the a & b coefficients of a row of pixels.
+///
+/// Inverts Sigma + eps * I of each pixel and applies it to the covariance of every input
+/// channel. A singular matrix yields a = 0, i.e. b = mean(p), instead of aborting the
+/// whole filter.
+///
+/// \tparam G Number of guidance channels.
+/// \param rows [in] Centered statistics, one row per statistic(CV_32FC1).
+/// \param coefs [out] a and b of each input channel, one row per coefficient.
+/// \param nChannel [in] Number of input channels.
+/// \param eps [in] The epsilon parameter in Guided Filtering.
+/// \param epsRow [in] The epsilon parameter of each pixel, overrides \p eps if not null.
+template <int G>
+static void solveCoefficientsRow(const cv::Mat &rows, cv::Mat &coefs, int nChannel,
+                                 float eps, const float *epsRow);
+
+/// Color guidance: Sigma is a symmetric 3x3 matrix, inverted through its adjugate.
+template <>
+void solveCoefficientsRow<3>(const cv::Mat &rows, cv::Mat &coefs, int nChannel, float eps,
+                             const float *epsRow) {
+  const auto n = rows.cols;
+  const auto s00 = rows.ptr<float>(RowSigma + 0);
+  const auto s01 = rows.ptr<float>(RowSigma + 1);
+  const auto s02 = rows.ptr<float>(RowSigma + 2);
+  const auto s11 = rows.ptr<float>(RowSigma + 3);
+  const auto s12 = rows.ptr<float>(RowSigma + 4);
+  const auto s22 = rows.ptr<float>(RowSigma + 5);
+  const auto meanI0 = rows.ptr<float>(RowMeanI<3> + 0);
+  const auto meanI1 = rows.ptr<float>(RowMeanI<3> + 1);
+  const auto meanI2 = rows.ptr<float>(RowMeanI<3> + 2);
+
+  int y = 0;
+#if CV_SIMD
+  constexpr auto nLane = cv::v_float32::nlanes;
+  const auto vEps = cv::vx_setall_f32(eps);
+  const auto vZero = cv::vx_setzero_f32();
+  const auto vOne = cv::vx_setall_f32(1.f);
+  for (; y <= n - nLane; y += nLane) {
+    // Sigma = Sigma + eps * I
+    const auto e = epsRow ? cv::vx_load(epsRow + y) : vEps;
+    const auto v00 = cv::vx_load(s00 + y) + e;
+    const auto v01 = cv::vx_load(s01 + y);
+    const auto v02 = cv::vx_load(s02 + y);
+    const auto v11 = cv::vx_load(s11 + y) + e;
+    const auto v12 = cv::vx_load(s12 + y);
+    const auto v22 = cv::vx_load(s22 + y) + e;
+    // Adjugate of Sigma
+    auto inv00 = v22 * v11 - v12 * v12;
+    auto inv01 = v02 * v12 - v22 * v01;
+    auto inv02 = v01 * v12 - v02 * v11;
+    auto inv11 = v22 * v00 - v02 * v02;
+    auto inv12 = v01 * v02 - v00 * v12;
+    auto inv22 = v00 * v11 - v01 * v01;
+    const auto det = v00 * inv00 + v01 * inv01 + v02 * inv02;
+    const auto invDet = cv::v_select(det != vZero, vOne / det, vZero);
+    inv00 = inv00 * invDet;
+    inv01 = inv01 * invDet;
+    inv02 = inv02 * invDet;
+    inv11 = inv11 * invDet;
+    inv12 = inv12 * invDet;
+    inv22 = inv22 * invDet;
+    const auto vI0 = cv::vx_load(meanI0 + y);
+    const auto vI1 = cv::vx_load(meanI1 + y);
+    const auto vI2 = cv::vx_load(meanI2 + y);
+    for (int c = 0; c < nChannel; ++c) {
+      const auto row = RowInput<3> + c * RowsPerInput<3>;
+      const auto cov0 = cv::vx_load(rows.ptr<float>(row + RowCov + 0) + y);
+      const auto cov1 = cv::vx_load(rows.ptr<float>(row + RowCov + 1) + y);
+      const auto cov2 = cv::vx_load(rows.ptr<float>(row + RowCov + 2) + y);
+      const auto meanP = cv::vx_load(rows.ptr<float>(row + RowMeanP<3>) + y);
+      const auto a0 = snapCoefficient(cov0 * inv00 + cov1 * inv01 + cov2 * inv02);
+      const auto a1 = snapCoefficient(cov0 * inv01 + cov1 * inv11 + cov2 * inv12);
+      const auto a2 = snapCoefficient(cov0 * inv02 + cov1 * inv12 + cov2 * inv22);
+      const auto b = snapCoefficient(meanP - a0 * vI0 - a1 * vI1 - a2 * vI2);
+      const auto coef = c * CoefsPerInput<3>;
+      cv::v_store(coefs.ptr<float>(coef + CoefA + 0) + y, a0);
+      cv::v_store(coefs.ptr<float>(coef + CoefA + 1) + y, a1);
+      cv::v_store(coefs.ptr<float>(coef + CoefA + 2) + y, a2);
+      cv::v_store(coefs.ptr<float>(coef + CoefB<3>) + y, b);
+    }
+  }
+  cv::vx_cleanup();
+#endif
+
+  for (; y < n; ++y) {
+    // Unroll the 3x3 matrix algebra
+    // Sigma Matrix:
+    // v00 v01 v02
+    // v01 v11 v12
+    // v02 v12 v22
+    const auto e = epsRow ? epsRow[y] : eps;
+    const auto v00 = s00[y] + e;
+    const auto v01 = s01[y];
+    const auto v02 = s02[y];
+    const auto v11 = s11[y] + e;
+    const auto v12 = s12[y];
+    const auto v22 = s22[y] + e;
+    auto inv00 = v22 * v11 - v12 * v12;
+    auto inv01 = v02 * v12 - v22 * v01;
+    auto inv02 = v01 * v12 - v02 * v11;
+    auto inv11 = v22 * v00 - v02 * v02;
+    auto inv12 = v01 * v02 - v00 * v12;
+    auto inv22 = v00 * v11 - v01 * v01;
+    const auto det = v00 * inv00 + v01 * inv01 + v02 * inv02;
+    const auto invDet = det != 0 ? 1.f / det : 0.f;
+    inv00 *= invDet;
+    inv01 *= invDet;
+    inv02 *= invDet;
+    inv11 *= invDet;
+    inv12 *= invDet;
+    inv22 *= invDet;
+    for (int c = 0; c < nChannel; ++c) {
+      const auto row = RowInput<3> + c * RowsPerInput<3>;
+      const auto cov0 = rows.ptr<float>(row + RowCov + 0)[y];
+      const auto cov1 = rows.ptr<float>(row + RowCov + 1)[y];
+      const auto cov2 = rows.ptr<float>(row + RowCov + 2)[y];
+      const auto meanP = rows.ptr<float>(row + RowMeanP<3>)[y];
+      const auto a0 = snapCoefficient(cov0 * inv00 + cov1 * inv01 + cov2 * inv02);
+      const auto a1 = snapCoefficient(cov0 * inv01 + cov1 * inv11 + cov2 * inv12);
+      const auto a2 = snapCoefficient(cov0 * inv02 + cov1 * inv12 + cov2 * inv22);
+      const auto b =
+          snapCoefficient(meanP - a0 * meanI0[y] - a1 * meanI1[y] - a2 * meanI2[y]);
+      const auto coef = c * CoefsPerInput<3>;
+      coefs.ptr<float>(coef + CoefA + 0)[y] = a0;
+      coefs.ptr<float>(coef + CoefA + 1)[y] = a1;
+      coefs.ptr<float>(coef + CoefA + 2)[y] = a2;
+      coefs.ptr<float>(coef + CoefB<3>)[y] = b;
+    }
+  }
+}
+
+/// Gray guidance: Sigma is the variance of I, a scalar divide.
+template <>
+void solveCoefficientsRow<1>(const cv::Mat &rows, cv::Mat &coefs, int nChannel, float eps,
+                             const float *epsRow) {
+  const auto n = rows.cols;
+  const auto var = rows.ptr<float>(RowSigma);
+  const auto meanI = rows.ptr<float>(RowMeanI<1>);
+
+  int y = 0;
+#if CV_SIMD
+  constexpr auto nLane = cv::v_float32::nlanes;
+  const auto vEps = cv::vx_setall_f32(eps);
+  const auto vZero = cv::vx_setzero_f32();
+  const auto vOne = cv::vx_setall_f32(1.f);
+  for (; y <= n - nLane; y += nLane) {
+    const auto e = epsRow ? cv::vx_load(epsRow + y) : vEps;
+    const auto v = cv::vx_load(var + y) + e;
+    const auto inv = cv::v_select(v != vZero, vOne / v, vZero);
+    const auto vI = cv::vx_load(meanI + y);
+    for (int c = 0; c < nChannel; ++c) {
+      const auto row = RowInput<1> + c * RowsPerInput<1>;
+      const auto cov = cv::vx_load(rows.ptr<float>(row + RowCov) + y);
+      const auto meanP = cv::vx_load(rows.ptr<float>(row + RowMeanP<1>) + y);
+      const auto a = snapCoefficient(cov * inv);
+      const auto b = snapCoefficient(meanP - a * vI);
+      const auto coef = c * CoefsPerInput<1>;
+      cv::v_store(coefs.ptr<float>(coef + CoefA) + y, a);
+      cv::v_store(coefs.ptr<float>(coef + CoefB<1>) + y, b);
+    }
+  }
+  cv::vx_cleanup();
+#endif
+
+  for (; y < n; ++y) {
+    const auto v = var[y] + (epsRow ? epsRow[y] : eps);
+    const auto inv = v != 0 ? 1.f / v : 0.f;
+    for (int c = 0; c < nChannel; ++c) {
+      const auto row = RowInput<1> + c * RowsPerInput<1>;
+      const auto cov = rows.ptr<float>(row + RowCov)[y];
+      const auto meanP = rows.ptr<float>(row + RowMeanP<1>)[y];
+      const auto a = snapCoefficient(cov * inv);
+      const auto b = snapCoefficient(meanP - a * meanI[y]);
+      const auto coef = c * CoefsPerInput<1>;
+      coefs.ptr<float>(coef + CoefA)[y] = a;
+      coefs.ptr<float>(coef + CoefB<1>)[y] = b;
+    }
+  }
+}
+
+/// \brief Solve for the a & b coefficients of a row from the means of its statistics.
+/// \tparam G Number of guidance channels.
+/// \tparam T Element type of the coefficient plane, float or cv::float16_t.
+/// \param means [in] Interleaved windowed means of the statistics plane, or null to read
+///                   the centered statistics from \p centered.
+/// \param cRow [out] Interleaved a & b coefficients.
+/// \param nCol [in] Number of columns.
+/// \param nChannel [in] Number of input channels.
+/// \param eps [in] The epsilon parameter of each pixel in Guided Filtering.
+/// \param x [in] Index of the row in \p eps.
+/// \param solveRows [in,out] Scratch buffer for the centered statistics.
+/// \param coefRows [in,out] Scratch buffer for the coefficients.
+/// \param centered [in,out] The centered statistics of the row, one run of \p nCol per
+///                      statistic. Written if \p means is given, may be null then.
+template <int G, typename T>
+static void solveCoefficientsImpl(const double *means, T *cRow, int nCol, int nChannel,
+                                  const EpsMap &eps, int x, cv::Mat &solveRows,
+                                  cv::Mat &coefRows, float *centered) {
+  const auto nStat = StatInput<G> + StatsPerInput<G> * nChannel;
+  const auto nCoef = CoefsPerInput<G> * nChannel;
+  const auto nSolve = static_cast<int>(cv::alignSize(nCol, SolveAlign));
+  // The eps of each pixel is kept in an extra row after the statistics
+  const auto rowEps = nStat;
+  if (solveRows.size() != cv::Size(nSolve, nStat + 1)) {
+    solveRows = cv::Mat::zeros(nStat + 1, nSolve, CV_32FC1);
+    coefRows.create(nCoef, nSolve, CV_32FC1);
+  }
+
+  std::array<float *, MaxStats> rows;
+  for (int k = 0; k < nStat; ++k)
+    rows[k] = solveRows.ptr<float>(k);
+  if (!means) {
+    for (int k = 0; k < nStat; ++k)
+      std::copy_n(centered + k * nCol, nCol, rows[k]);
+  }
+  // Center the second moments in double precision before narrowing them
+  for (int y = 0; means && y < nCol; ++y) {
+    const auto m = means + y * nStat;
+    const auto meanI = m + StatI;
+    // Upper triangle of Sigma = mean(I * I^T) - mean(I) * mean(I)^T
+    for (int i = 0, k = 0; i < G; ++i)
+      for (int j = i; j < G; ++j, ++k)
+        rows[RowSigma + k][y] = m[StatII<G> + k] - meanI[i] * meanI[j];
+    for (int i = 0; i < G; ++i)
+      rows[RowMeanI<G> + i][y] = meanI[i];
+    for (int c = 0; c < nChannel; ++c) {
+      const auto pm = m + StatInput<G> + c * StatsPerInput<G>;
+      const auto meanP = pm[StatP];
+      // Covariance of I & P in each local patch
+      const auto pRows = rows.data() + RowInput<G> + c * RowsPerInput<G>;
+      for (int i = 0; i < G; ++i)
+        pRows[RowCov + i][y] = pm[StatIp + i] - meanI[i] * meanP;
+      pRows[RowMeanP<G>][y] = meanP;
+    }
+  }
+  if (means && centered) {
+    for (int k = 0; k < nStat; ++k)
+      std::copy_n(rows[k], nCol, centered + k * nCol);
+  }
+
+  const float *epsRow = nullptr;
+  if (!eps.isUniform()) {
+    eps.fillRow(x, solveRows.ptr<float>(rowEps), nCol);
+    epsRow = solveRows.ptr<float>(rowEps);
+  }
+  solveCoefficientsRow<G>(solveRows, coefRows, nChannel, static_cast<float>(eps.value),
+                          epsRow);
+
+  for (int k = 0; k < nCoef; ++k) {
+    const auto coefs = coefRows.ptr<float>(k);
+    for (int y = 0; y < nCol; ++y)
+      cRow[y * nCoef + k] = static_cast<T>(coefs[y]);
+  }
+}
+
+/// \brief Solve for the a & b coefficients of a row, see \ref solveCoefficientsImpl.
+/// \param nGuide [in] Number of guidance channels, 1 or 3.
+template <typename T>
+static void solveCoefficients(const double *means, T *cRow, int nCol, int nGuide,
+                              int nChannel, const EpsMap &eps, int x, cv::Mat &solveRows,
+                              cv::Mat &coefRows, float *centered = nullptr) {
+  if (nGuide == 1)
+    solveCoefficientsImpl<1>(means, cRow, nCol, nChannel, eps, x, solveRows, coefRows,
+                             centered);
+  else
+    solveCoefficientsImpl<3>(means, cRow, nCol, nChannel, eps, x, solveRows, coefRows,
+                             centered);
+}
+
+/// Divide \p num by \p den > 0, rounded to the nearest integer with halves away from 0.
+static int64_t roundDiv(int64_t num, int64_t den) {
+  return num >= 0 ? (num + den / 2) / den : -((den / 2 - num) / den);
+}
+
+/// Shift \p v right by \p shift > 0 bits, rounded to the nearest integer.
+static int64_t roundShift(int64_t v, int shift) {
+  return (v + (int64_t(1) << (shift - 1))) >> shift;
+}
+
+/// \brief `num / den` in fixed point with \p frac fractional bits, saturated to
+/// [-\p limit, \p limit].
+///
+/// The operands are first rounded so that \p den fits in 31 bits, which keeps the scaled
+/// numerator within 64 bits. A zero \p den yields 0, like a singular Sigma in the float
+/// solver.
+static int64_t fixedQuotient(int64_t num, int64_t den, int frac, int64_t limit) {
+  if (den <= 0)
+    return 0;
+  const auto shift = static_cast<int>(std::bit_width(static_cast<uint64_t>(den))) - 31;
+  if (shift > 0) {
+    num = roundShift(num, shift);
+    den = roundShift(den, shift);
+  }
+  // Quotients of 2^(31 - frac) or more are saturated anyway
+  if (std::abs(num) >= den << (31 - frac))
+    return num < 0 ? -limit : limit;
+  return std::clamp(roundDiv(num * (int64_t(1) << frac), den), -limit, limit);
+}
+
+/// \brief Solve for the fixed-point a & b coefficients of a row from the exact window sums
+/// of its integer statistics.
+///
+/// Sigma and the covariances are scaled by the squared window area N^2, which keeps them
+/// integers: `N^2 * cov(X, Y) = N * sum(X * Y) - sum(X) * sum(Y)`.
+///
+/// \tparam G Number of guidance channels.
+/// \param sums [in] Interleaved window sums of the statistics plane.
+/// \param areas [in] Number of pixels of the window of each column.
+/// \param cRow [out] Interleaved a & b coefficients, see \ref FixedFracA.
+/// \param nCol [in] Number of columns.
+/// \param nChannel [in] Number of input channels.
+/// \param epsRow [in] The epsilon parameter of each pixel.
+template <int G>
+static void solveFixedRowImpl(const int64_t *sums, const int *areas, int *cRow, int nCol,
+                              int nChannel, const float *epsRow) {
+  const auto nStat = StatInput<G> + StatsPerInput<G> * nChannel;
+  const auto nCoef = CoefsPerInput<G> * nChannel;
+  for (int y = 0; y < nCol; ++y) {
+    const auto s = sums + y * nStat;
+    const int64_t N = areas[y];
+    const auto sI = s + StatI;
+    const auto epsN = std::llround(static_cast<double>(epsRow[y]) * N * N);
+    // Upper triangle of N^2 * (Sigma + eps * I)
+    std::array<int64_t, G *(G + 1) / 2> sigma;
+    for (int i = 0, k = 0; i < G; ++i)
+      for (int j = i; j < G; ++j, ++k)
+        sigma[k] = N * s[StatII<G> + k] - sI[i] * sI[j] + (i == j ? epsN : 0);
+    // N^2 * cov(I, p) of each input channel
+    std::array<int64_t, 3 * G> cov;
+    for (int c = 0; c < nChannel; ++c) {
+      const auto pm = s + StatInput<G> + c * StatsPerInput<G>;
+      for (int i = 0; i < G; ++i)
+        cov[c * G + i] = N * pm[StatIp + i] - sI[i] * pm[StatP];
+    }
+
+    // a = Sigma^-1 * cov, as the numerators of each a over a shared denominator
+    std::array<int64_t, 3 * G> num;
+    int64_t den;
+    if constexpr (G == 1) {
+      den = sigma[0];
+      std::copy_n(cov.begin(), nChannel, num.begin());
+    } else {
+      // Round Sigma and the covariances to a shared scale, so that the adjugate and the
+      // determinant fit in 64 bits. Sigma is positive semi-definite, so its diagonal bounds
+      // all of its entries.
+      auto maxAbs = std::max({sigma[0], sigma[3], sigma[5]});
+      for (int i = 0; i < G * nChannel; ++i)
+        maxAbs = std::max(maxAbs, std::abs(cov[i]));
+      const auto shift =
+          static_cast<int>(std::bit_width(static_cast<uint64_t>(maxAbs))) - FixedSigmaBits;
+      if (shift > 0) {
+        for (auto &v : sigma)
+          v = roundShift(v, shift);
+        for (int i = 0; i < G * nChannel; ++i)
+          cov[i] = roundShift(cov[i], shift);
+      }
+      const auto [v00, v01, v02, v11, v12, v22] = sigma;
+      const auto inv00 = v22 * v11 - v12 * v12;
+      const auto inv01 = v02 * v12 - v22 * v01;
+      const auto inv02 = v01 * v12 - v02 * v11;
+      const auto inv11 = v22 * v00 - v02 * v02;
+      const auto inv12 = v01 * v02 - v00 * v12;
+      const auto inv22 = v00 * v11 - v01 * v01;
+      den = v00 * inv00 + v01 * inv01 + v02 * inv02;
+      for (int c = 0; c < nChannel; ++c) {
+        const auto cp = cov.data() + c * G, n = num.data() + c * G;
+        n[0] = cp[0] * inv00 + cp[1] * inv01 + cp[2] * inv02;
+        n[1] = cp[0] * inv01 + cp[1] * inv11 + cp[2] * inv12;
+        n[2] = cp[0] * inv02 + cp[1] * inv12 + cp[2] * inv22;
+      }
+    }
+
+    for (int c = 0; c < nChannel; ++c) {
+      const auto sumP = s[StatInput<G> + c * StatsPerInput<G> + StatP];
+      const auto coefs = cRow + y * nCoef + c * CoefsPerInput<G>;
+      // b = (sum(p) - a * sum(I)) / N with the rounded a
+      auto b = sumP * (int64_t(1) << FixedFracA);
+      for (int i = 0; i < G; ++i) {
+        const auto a = fixedQuotient(num[c * G + i], den, FixedFracA, FixedMaxA);
+        coefs[CoefA + i] = static_cast<int>(a);
+        b -= a * sI[i];
+      }
+      b = roundDiv(b, N << (FixedFracA - FixedFracB));
+      coefs[CoefB<G>] = static_cast<int>(std::clamp(b, -FixedMaxB, FixedMaxB));
+    }
+  }
+}
+
+/// \brief Solve for the fixed-point a & b of a row, see \ref solveFixedRowImpl.
+/// \param nGuide [in] Number of guidance channels, 1 or 3.
+static void solveFixedRow(const int64_t *sums, const int *areas, int *cRow, int nCol,
+                          int nGuide, int nChannel, const float *epsRow) {
+  if (nGuide == 1)
+    solveFixedRowImpl<1>(sums, areas, cRow, nCol, nChannel, epsRow);
+  else
+    solveFixedRowImpl<3>(sums, areas, cRow, nCol, nChannel, epsRow);
+}
+
+/// \brief Apply the averaged a & b coefficients of an input channel to a guidance pixel.
+/// \tparam G Number of guidance channels.
+/// \param m [in] a & b of the input channel.
+/// \param I [in] The guidance pixel.
+template <int G, typename M, typename P>
+static auto applyCoefficients(const M *m, const P *I) {
+  auto v = m[CoefA] * I[0];
+  for (int i = 1; i < G; ++i)
+    v += m[CoefA + i] * I[i];
+  return v + m[CoefB<G>];
+}
+
+/// \brief Apply the averaged coefficients of a row to the guidance.
+///
+/// Pixels in runs of radius 0 are left untouched, they keep their input values.
+///
+/// \tparam G Number of guidance channels.
+/// \tparam P Element type of the guidance, uchar, ushort or float.
+/// \tparam D Element type of the output, saturated if it is an integer.
+/// \param means [in] Interleaved windowed means of the coefficient plane.
+/// \param IRow [in] The same row of the guidance image(G channels).
+/// \param spans [in] Runs of the same row of the radius map.
+/// \param begin [in] First column to write.
+/// \param end [in] One past the last column to write.
+/// \param nChannel [in] Number of input channels.
+/// \param dRow [in,out] The same row of the output image.
+template <int G, typename P, typename D>
+static void combineRowImpl(const double *means, const P *IRow,
+                           std::span<const RadiusSpan> spans, int begin, int end,
+                           int nChannel, D *dRow) {
+  const auto nCoef = CoefsPerInput<G> * nChannel;
+  for (const auto &span : spans) {
+    if (span.slot == RadiusSpan::Identity)
+      continue;
+    for (int y = std::max(span.begin, begin); y < std::min(span.end, end); ++y)
+      for (int c = 0; c < nChannel; ++c)
+        dRow[y * nChannel + c] = cv::saturate_cast<D>(applyCoefficients<G>(
+            means + y * nCoef + c * CoefsPerInput<G>, IRow + G * y));
+  }
+}
+
+/// \brief Apply the averaged coefficients of a row, see \ref combineRowImpl.
+/// \param nGuide [in] Number of guidance channels, 1 or 3.
+template <typename P, typename D>
+static void combineRow(const double *means, const P *IRow,
+                       std::span<const RadiusSpan> spans, int begin, int end, int nGuide,
+                       int nChannel, D *dRow) {
+  if (nGuide == 1)
+    combineRowImpl<1>(means, IRow, spans, begin, end, nChannel, dRow);
+  else
+    combineRowImpl<3>(means, IRow, spans, begin, end, nChannel, dRow);
+}
+
+/// \brief Apply the window sums of the fixed-point coefficients of a row to the guidance.
+///
+/// `(sum(a) * I + sum(b)) / N` is evaluated in 64-bit integers, rounded and saturated.
+/// Pixels in runs of radius 0 are left untouched, they keep their input values.
+///
+/// \tparam G Number of guidance channels.
+/// \param sums [in] Interleaved window sums of the coefficient plane.
+/// \param areas [in] Number of pixels of the window of each column.
+/// \param IRow [in] The same row of the guidance image(G channels).
+/// \param spans [in] Runs of the same row of the radius map.
+/// \param begin [in] First column to write.
+/// \param end [in] One past the last column to write.
+/// \param nChannel [in] Number of input channels.
+/// \param dRow [in,out] The same row of the output image.
+template <int G>
+static void combineFixedRowImpl(const int64_t *sums, const int *areas, const uchar *IRow,
+                                std::span<const RadiusSpan> spans, int begin, int end,
+                                int nChannel, uchar *dRow) {
+  const auto nCoef = CoefsPerInput<G> * nChannel;
+  for (const auto &span : spans) {
+    if (span.slot == RadiusSpan::Identity)
+      continue;
+    for (int y = std::max(span.begin, begin); y < std::min(span.end, end); ++y) {
+      const auto den = int64_t(areas[y]) << FixedFracA;
+      const auto I = IRow + G * y;
+      for (int c = 0; c < nChannel; ++c) {
+        const auto m = sums + y * nCoef + c * CoefsPerInput<G>;
+        auto v = m[CoefB<G>] * (int64_t(1) << (FixedFracA - FixedFracB));
+        for (int i = 0; i < G; ++i)
+          v += m[CoefA + i] * I[i];
+        dRow[y * nChannel + c] = cv::saturate_cast<uchar>(roundDiv(v, den));
+      }
+    }
+  }
+}
+
+/// \brief Apply the fixed-point coefficients of a row, see \ref combineFixedRowImpl.
+/// \param nGuide [in] Number of guidance channels, 1 or 3.
+static void combineFixedRow(const int64_t *sums, const int *areas, const uchar *IRow,
+                            std::span<const RadiusSpan> spans, int begin, int end,
+                            int nGuide, int nChannel, uchar *dRow) {
+  if (nGuide == 1)
+    combineFixedRowImpl<1>(sums, areas, IRow, spans, begin, end, nChannel, dRow);
+  else
+    combineFixedRowImpl<3>(sums, areas, IRow, spans, begin, end, nChannel, dRow);
+}
+
+/// \brief Apply the upsampled mean coefficients of a row to the guidance.
+///
+/// Pixels with radius 0 are left untouched, they keep their input values.
+///
+/// \tparam G Number of guidance channels.
+/// \tparam P Element type of the guidance, uchar, ushort or float.
+/// \tparam D Element type of the output, saturated if it is an integer.
+/// \param mRow [in] The same row of the upsampled mean coefficients.
+/// \param IRow [in] A row of the guidance image(G channels).
+/// \param rRow [in] The same row of the radius map.
+/// \param nCol [in] Number of columns.
+/// \param nChannel [in] Number of input channels.
+/// \param dRow [in,out] The same row of the output image.
+template <int G, typename P, typename D>
+static void combineDenseRowImpl(const float *mRow, const P *IRow, const float *rRow,
+                                int nCol, int nChannel, D *dRow) {
+  const auto nCoef = CoefsPerInput<G> * nChannel;
+  for (int y = 0; y < nCol; ++y) {
+    if (rRow[y] == 0)
+      continue;
+    for (int c = 0; c < nChannel; ++c)
+      dRow[y * nChannel + c] = cv::saturate_cast<D>(
+          applyCoefficients<G>(mRow + y * nCoef + c * CoefsPerInput<G>, IRow + G * y));
+  }
+}
+
+/// \brief Apply the upsampled mean coefficients of a row, see \ref combineDenseRowImpl.
+/// \param nGuide [in] Number of guidance channels, 1 or 3.
+template <typename P, typename D>
+static void combineDenseRow(const float *mRow, const P *IRow, const float *rRow, int nCol,
+                            int nGuide, int nChannel, D *dRow) {
+  if (nGuide == 1)
+    combineDenseRowImpl<1>(mRow, IRow, rRow, nCol, nChannel, dRow);
+  else
+    combineDenseRowImpl<3>(mRow, IRow, rRow, nCol, nChannel, dRow);
+}
+
+/// \brief Append one row to a multi-channel summed-area table.
+///
+/// The table is padded by \p pad columns on either side, zeros on the left and copies of
+/// the last column on the right, so that windows reaching up to \p pad pixels past the
+/// border are looked up without clamping.
+///
+/// \param src [in] The next row of the source plane.
+/// \param sPrev [in] The last row of the table.
+/// \param sCur [out] The new row of the table, `nCol + 1 + 2 * pad` columns.
+/// \param nCol [in] Number of columns of the source plane.
+/// \param K [in] Number of channels.
+/// \param pad [in] Number of padding columns on either side.
+template <typename T, typename S>
+static void accumulateIntegralRow(const T *src, const S *sPrev, S *sCur, int nCol, int K,
+                                  int pad) {
+  std::fill_n(sCur, (pad + 1) * K, S(0));
+  sPrev += pad * K;
+  sCur += pad * K;
+  for (int y = 0; y < nCol; ++y)
+    for (int k = 0; k < K; ++k) {
+      const auto i = y * K + k;
+      sCur[i + K] = sCur[i] + sPrev[i + K] - sPrev[i] + src[i];
+    }
+  const auto last = sCur + nCol * K;
+  for (int y = 1; y <= pad; ++y)
+    std::copy_n(last, K, last + y * K);
+}
+
+/// \brief Build the summed-area table of a plane.
+///
+/// The table has `rows + 1` rows and is padded by `(cols - plane.cols - 1) / 2` columns on
+/// either side, see \ref accumulateIntegralRow.
+///
+/// \param plane [in] Source plane(CV_8U, CV_32S, CV_32F or CV_16F).
+/// \param integralImg [out] Summed-area table(CV_64F, or CV_32S for integer planes) of the
+///                          channels of \p plane, allocated by the caller.
+static void buildIntegral(const cv::Mat &plane, cv::Mat &integralImg) {
+  const auto K = plane.channels();
+  const auto pad = (integralImg.cols - plane.cols - 1) / 2;
+  CV_Assert(integralImg.rows == plane.rows + 1 && integralImg.channels() == K &&
+            integralImg.cols == plane.cols + 1 + 2 * pad && pad >= 0);
+  const auto build = [&](auto zeroT, auto zeroS) {
+    using T = decltype(zeroT);
+    using S = decltype(zeroS);
+    std::fill_n(integralImg.ptr<S>(0), integralImg.cols * K, S(0));
+    for (int x = 0; x < plane.rows; ++x)
+      accumulateIntegralRow(plane.ptr<T>(x), integralImg.ptr<S>(x),
+                            integralImg.ptr<S>(x + 1), plane.cols, K, pad);
+  };
+  const auto buildIntegers = [&](auto zeroT) {
+    if (integralImg.depth() == CV_32S)
+      build(zeroT, 0);
+    else
+      build(zeroT, 0.0);
+  };
+
+  switch (plane.depth()) {
+  case CV_8U:
+    buildIntegers(uchar(0));
+    break;
+  case CV_32S:
+    buildIntegers(0);
+    break;
+  case CV_16F:
+    build(cv::float16_t(), 0.0);
+    break;
+  case CV_64F:
+    build(0.0, 0.0);
+    break;
+  default:
+    CV_Assert(plane.depth() == CV_32F);
+    build(0.f, 0.0);
+  }
+}
+
+/// \brief Call \p fn with each column of a run and the reciprocal of its window width.
+///
+/// Columns whose window `[y - before, y + after]` lies inside `[0, nCol)` share the
+/// reciprocal of the full width, so the interior is a loop without branches. Only the few
+/// columns whose window is clipped by the border look the reciprocal of their clipped width
+/// up in \p invWidths. The columns are visited in order.
+///
+/// \param begin [in] First column of the run.
+/// \param end [in] One past the last column of the run.
+/// \param invWidths [in] Reciprocals of the window widths, see \ref RadiusSpans::invWidths.
+template <typename Fn>
+static void forEachWindow(int begin, int end, int before, int after, int nCol,
+                          const double *invWidths, Fn &&fn) {
+  const auto interiorBegin = std::clamp(before, begin, end);
+  const auto interiorEnd = std::clamp(nCol - after, interiorBegin, end);
+  const auto border = [&](int y) {
+    fn(y, invWidths[std::min(y + after, nCol - 1) - std::max(y - before, 0) + 1]);
+  };
+  for (int y = begin; y < interiorBegin; ++y)
+    border(y);
+  const auto invWidth = invWidths[before + after + 1];
+  for (int y = interiorBegin; y < interiorEnd; ++y)
+    fn(y, invWidth);
+  for (int y = interiorEnd; y < end; ++y)
+    border(y);
+}
+
+/// \brief Depth of the summed-area table of a plane.
+///
+/// Integer planes are summed exactly: into CV_32S if no sum can overflow for the size of
+/// the plane and its largest value, otherwise into CV_64F, which holds integers up to 2^53
+/// exactly.
+///
+/// \param plane [in] The plane(CV_8U, CV_32S, CV_32F, CV_64F or CV_16F).
+/// \param maxValue [in] Upper bound of the values of \p plane.
+static int integralDepth(const cv::Mat &plane, double maxValue) {
+  if (plane.depth() != CV_8U && plane.depth() != CV_32S)
+    return CV_64F;
+  const auto maxSum = static_cast<double>(plane.total()) * maxValue;
+  return maxSum <= std::numeric_limits<int>::max() ? CV_32S : CV_64F;
+}
+
+/// \brief Build one row of the statistics plane.
+///
+/// The statistics of integer-valued inputs are stored as integers(T = int), so that they
+/// are summed exactly. Half-precision statistics(T = cv::float16_t) are computed in float
+/// and only rounded when stored. The products of 16-bit values reach 2^32, which overflows
+/// int and drops about 8 bits in float, so they are computed and stored in double(T =
+/// double), where they are exact.
+///
+/// \tparam G Number of guidance channels.
+/// \tparam P Element type of the input and the guidance, uchar, ushort or float.
+/// \param pRow [in] A row of the input image(1 or 3 channels).
+/// \param IRow [in] The same row of the guidance image(G channels).
+/// \param sRow [out] The same row of the statistics plane.
+/// \param nCol [in] Number of columns.
+/// \param nChannel [in] Number of input channels.
+template <int G, typename P, typename T>
+static void buildStatsRowImpl(const P *pRow, const P *IRow, T *sRow, int nCol,
+                              int nChannel) {
+  // Type the products are computed in
+  using C =
+      std::conditional_t<std::is_integral_v<T> || std::is_same_v<T, double>, T, float>;
+  const auto nStat = StatInput<G> + StatsPerInput<G> * nChannel;
+  for (int y = 0; y < nCol; ++y) {
+    std::array<C, G> I;
+    for (int i = 0; i < G; ++i)
+      I[i] = static_cast<C>(IRow[G * y + i]);
+    auto stats = sRow + y * nStat;
+    for (int i = 0, k = 0; i < G; ++i) {
+      stats[StatI + i] = static_cast<T>(I[i]);
+      for (int j = i; j < G; ++j, ++k)
+        stats[StatII<G> + k] = static_cast<T>(I[i] * I[j]);
+    }
+    for (int c = 0; c < nChannel; ++c) {
+      const auto p = static_cast<C>(pRow[y * nChannel + c]);
+      auto pStats = stats + StatInput<G> + c * StatsPerInput<G>;
+      pStats[StatP] = static_cast<T>(p);
+      for (int i = 0; i < G; ++i)
+        pStats[StatIp + i] = static_cast<T>(I[i] * p);
+    }
+  }
+}
+
+/// \brief Build one row of the statistics plane, see \ref buildStatsRowImpl.
+/// \param nGuide [in] Number of guidance channels, 1 or 3.
+template <typename P, typename T>
+static void buildStatsRow(const P *pRow, const P *IRow, T *sRow, int nCol, int nGuide,
+                          int nChannel) {
+  if (nGuide == 1)
+    buildStatsRowImpl<1>(pRow, IRow, sRow, nCol, nChannel);
+  else
+    buildStatsRowImpl<3>(pRow, IRow, sRow, nCol, nChannel);
+}
+
+/// \brief Evaluate the windowed means of all channels of a plane, row by row.
+///
+/// Runs served by running sums slide them down to their row, other runs read the
+/// summed-area table. Once a row is done, \p onRow is called with the row index and a
+/// buffer holding the `cols * channels` interleaved means of that row(or their window
+/// sums, see \p Sums). The running sums are local to the call, so disjoint row ranges can
+/// be swept concurrently.
+///
+/// A window of radius r spans `ceil(r)` pixels before and `floor(r)` pixels after the
+/// center. Windows clipped by the border are normalized by their clipped area. The running
+/// sums and the table are padded by the largest radius, so only the normalization of the
+/// columns near the border differs from the interior(see \ref forEachWindow).
+///
+/// \tparam T Element type of the plane.
+/// \tparam Acc Type of the running sums, exact for integer planes.
+/// \tparam S Element type of the summed-area table.
+/// \tparam Sums Whether to hand out the window sums(of type Acc) instead of the means,
+///              together with the number of pixels of the window of each column.
+/// \param plane [in] Interleaved source plane(K channels).
+/// \param integralImg [in] Summed-area table of \p plane(K channels) padded by at least
+///                         `ceil(spans.maxRadius)` columns(see \ref buildIntegral), only
+///                         needed if \p spans has runs that fall back to integral image
+///                         lookups.
+/// \param spans [in] Run-length layout of the radius map.
+/// \param rows [in] The rows to evaluate.
+template <typename T, typename Acc, typename S, bool Sums, typename RowFn>
+static void sweepMeansImpl(const cv::Mat &plane, const cv::Mat &integralImg,
+                           const RadiusSpans &spans, const cv::Range &rows, RowFn &&onRow) {
+  CV_Assert(plane.depth() == cv::DataType<T>::depth && plane.size() == spans.size);
+  const auto K = plane.channels();
+  const auto nRow = plane.rows, nCol = plane.cols, nElem = nCol * K;
+  const auto integralPad = (integralImg.cols - nCol - 1) / 2;
+  CV_Assert(!spans.needsIntegral || (integralImg.depth() == cv::DataType<S>::depth &&
+                                     integralImg.rows == nRow + 1 &&
+                                     integralPad >= cvCeil(spans.maxRadius)));
+  const auto invWidths = spans.invWidths.data();
+  // Number of rows of the window of radius r around row x, and of columns around column y
+  const auto windowRows = [&](int x, int before, int after) {
+    return std::min(x + after, nRow - 1) - std::max(x - before, 0) + 1;
+  };
+  const auto windowCols = [&](int y, int before, int after) {
+    return std::min(y + after, nCol - 1) - std::max(y - before, 0) + 1;
+  };
+
+  // Vertical running sums of each column, one row per radius in `spans.radii`. They are
+  // padded by zeros on either side, so that the horizontal windows slide past the border
+  // without clamping.
+  const auto nSlot = static_cast<int>(spans.radii.size());
+  const auto pad = (nSlot > 0 ? cvCeil(std::ranges::max(spans.radii)) : 0) + 1;
+  const auto nPaddedElem = nElem + 2 * pad * K;
+  std::vector<Acc> colSums(static_cast<size_t>(nSlot) * nPaddedElem, Acc(0));
+  const auto colSumsOf = [&](int slot) {
+    return colSums.data() + static_cast<size_t>(slot) * nPaddedElem + pad * K;
+  };
+  const auto addRow = [&](Acc *colSum, int x, int sign) {
+    const auto sRow = plane.ptr<T>(x);
+    if (sign > 0)
+      for (int j = 0; j < nElem; ++j)
+        colSum[j] += sRow[j];
+    else
+      for (int j = 0; j < nElem; ++j)
+        colSum[j] -= sRow[j];
+  };
+  // A slot is only moved down to the rows that read it, the row of the window it holds is
+  // kept in `slotRows`. Sliding a window by n rows touches 2n rows, so a slot that lags by
+  // more than half of its window height is summed afresh. With many radii that each cover
+  // a few rows, most slots are idle on any given row.
+  constexpr auto Unset = std::numeric_limits<int>::min();
+  std::vector<int> slotRows(nSlot, Unset);
+  const auto moveSlot = [&](int slot, int x) {
+    auto &at = slotRows[slot];
+    if (at == x)
+      return;
+    const auto before = cvCeil(spans.radii[slot]), after = cvFloor(spans.radii[slot]);
+    auto colSum = colSumsOf(slot);
+    if (at == Unset || 2 * (x - at) > before + after + 1) {
+      std::fill_n(colSum, nElem, Acc(0));
+      for (int i = std::max(x - before, 0); i < std::min(x + after + 1, nRow); ++i)
+        addRow(colSum, i, 1);
+    } else {
+      for (int i = at + 1; i <= x; ++i) {
+        if (i + after < nRow)
+          addRow(colSum, i + after, 1);
+        if (i - before - 1 >= 0)
+          addRow(colSum, i - before - 1, -1);
+      }
+    }
+    at = x;
+  };
+
+  std::vector<std::conditional_t<Sums, Acc, double>> mRow(nElem);
+  std::vector<int> areas(Sums ? nCol : 0);
+  // Horizontal window sums of each channel
+  std::vector<Acc> sum(K);
+  for (int x = rows.start; x < rows.end; ++x) {
+    const auto sRow = plane.ptr<T>(x);
+    for (const auto &span : spans.row(x)) {
+      if (span.slot == RadiusSpan::Identity) {
+        std::copy(sRow + span.begin * K, sRow + span.end * K, mRow.data() + span.begin * K);
+        if constexpr (Sums)
+          std::fill(areas.begin() + span.begin, areas.begin() + span.end, 1);
+        continue;
+      }
+
+      const auto r = span.radius;
+      const auto before = cvCeil(r), after = cvFloor(r);
+      const auto height = windowRows(x, before, after);
+      const auto invHeight = invWidths[height];
+      if (span.slot == RadiusSpan::Integral) {
+        const auto sTop = integralImg.ptr<S>(std::max(x - before, 0)) + integralPad * K;
+        const auto sBottom = integralImg.ptr<S>(std::min(x + after + 1, nRow)) +
+                             integralPad * K;
+        forEachWindow(span.begin, span.end, before, after, nCol, invWidths,
+                      [&](int y, double invWidth) {
+                        const auto iL = (y - before) * K;
+                        const auto iR = (y + after + 1) * K;
+                        const auto invArea = invHeight * invWidth;
+                        if constexpr (Sums)
+                          areas[y] = height * windowCols(y, before, after);
+                        for (int k = 0; k < K; ++k) {
+                          const auto windowSum = static_cast<Acc>(sBottom[iR + k]) +
+                                                 sTop[iL + k] - sTop[iR + k] -
+                                                 sBottom[iL + k];
+                          if constexpr (Sums)
+                            mRow[y * K + k] = static_cast<Acc>(windowSum);
+                          else
+                            mRow[y * K + k] = static_cast<double>(windowSum) * invArea;
+                        }
+                      });
+        continue;
+      }
+
+      // Horizontal sliding window over the vertical running sums, moved down to
+      // [x - before, x + after]
+      moveSlot(span.slot, x);
+      const auto colSum = colSumsOf(span.slot);
+      std::fill(sum.begin(), sum.end(), Acc(0));
+      for (int y = span.begin - before; y <= span.begin + after; ++y)
+        for (int k = 0; k < K; ++k)
+          sum[k] += colSum[y * K + k];
+      forEachWindow(span.begin, span.end, before, after, nCol, invWidths,
+                    [&](int y, double invWidth) {
+                      if constexpr (Sums) {
+                        areas[y] = height * windowCols(y, before, after);
+                        std::copy(sum.begin(), sum.end(), mRow.data() + y * K);
+                      } else {
+                        const auto invArea = invHeight * invWidth;
+                        for (int k = 0; k < K; ++k)
+                          mRow[y * K + k] = static_cast<double>(sum[k]) * invArea;
+                      }
+                      // Slide to the window of y + 1
+                      for (int k = 0; k < K; ++k) {
+                        sum[k] += colSum[(y + after + 1) * K + k];
+                        sum[k] -= colSum[(y - before) * K + k];
+                      }
+                    });
+    }
+
+    if constexpr (Sums)
+      onRow(x, static_cast<const Acc *>(mRow.data()),
+            static_cast<const int *>(areas.data()));
+    else
+      onRow(x, static_cast<const double *>(mRow.data()));
+  }
+}
+
+/// \brief Evaluate the windowed means of all channels of a plane, row by row.
+///
+/// Float planes(CV_32F or CV_16F) are summed in double precision, integer planes(CV_8U or
+/// CV_32S) exactly in 64-bit integers. See \ref sweepMeansImpl.
+template <typename RowFn>
+static void sweepMeans(const cv::Mat &plane, const cv::Mat &integralImg,
+                       const RadiusSpans &spans, const cv::Range &rows, RowFn &&onRow) {
+  const auto sweepIntegers = [&](auto zero) {
+    using T = decltype(zero);
+    if (spans.needsIntegral && integralImg.depth() == CV_32S)
+      sweepMeansImpl<T, int64_t, int, false>(plane, integralImg, spans, rows, onRow);
+    else
+      sweepMeansImpl<T, int64_t, double, false>(plane, integralImg, spans, rows, onRow);
+  };
+
+  switch (plane.depth()) {
+  case CV_8U:
+    sweepIntegers(uchar(0));
+    break;
+  case CV_32S:
+    sweepIntegers(0);
+    break;
+  case CV_16F:
+    sweepMeansImpl<cv::float16_t, double, double, false>(plane, integralImg, spans, rows,
+                                                         onRow);
+    break;
+  case CV_64F:
+    sweepMeansImpl<double, double, double, false>(plane, integralImg, spans, rows, onRow);
+    break;
+  default:
+    sweepMeansImpl<float, double, double, false>(plane, integralImg, spans, rows, onRow);
+  }
+}
+
+/// \brief Evaluate the exact window sums of all channels of an integer plane, row by row.
+///
+/// Like \ref sweepMeans, but \p onRow receives the `cols * channels` interleaved 64-bit
+/// window sums of the row and the number of pixels of the window of each column.
+///
+/// \param plane [in] Interleaved source plane(CV_32S).
+template <typename RowFn>
+static void sweepSums(const cv::Mat &plane, const cv::Mat &integralImg,
+                      const RadiusSpans &spans, const cv::Range &rows, RowFn &&onRow) {
+  CV_Assert(plane.depth() == CV_32S);
+  if (spans.needsIntegral && integralImg.depth() == CV_32S)
+    sweepMeansImpl<int, int64_t, int, true>(plane, integralImg, spans, rows, onRow);
+  else
+    sweepMeansImpl<int, int64_t, double, true>(plane, integralImg, spans, rows, onRow);
+}
+
+/// \brief Number of row stripes a sweep over \p spans is split into.
+///
+/// Every stripe primes its own running sums, so a stripe is kept several times taller
+/// than the largest running window. The count honours `cv::setNumThreads`.
+static double stripeCount(const RadiusSpans &spans) {
+  const auto maxRadius = spans.radii.empty() ? 0 : cvCeil(std::ranges::max(spans.radii));
+  const auto minRows = 4 * (2 * maxRadius + 1);
+  return std::clamp(spans.size.height / minRows, 1, std::max(cv::getNumThreads(), 1));
+}
+
+/// \brief Run \ref sweepMeans over \p rows split into row stripes that run in parallel.
+/// \tparam Sums Whether to run \ref sweepSums instead.
+template <bool Sums = false, typename RowFn>
+static void parallelSweepMeans(const cv::Mat &plane, const cv::Mat &integralImg,
+                               const RadiusSpans &spans, const cv::Range &rows,
+                               const RowFn &onRow) {
+  cv::parallel_for_(
+      rows,
+      [&](const cv::Range &stripe) {
+        if constexpr (Sums)
+          sweepSums(plane, integralImg, spans, stripe, onRow);
+        else
+          sweepMeans(plane, integralImg, spans, stripe, onRow);
+      },
+      stripeCount(spans));
+}
+
 void GuidedFilter::dynamicMeanFilter(const cv::Mat &src, cv::Mat &dst,
                                      const cv::Mat &radius) {
-  CV_Assert(src.depth() == CV_32F && radius.depth() == CV_32F);
-  cv::integral(src, workImg);
-  const auto nRow = workImg.rows, nCol = workImg.cols;
-  for (size_t x = 0; x < src.rows; ++x)
-    for (size_t y = 0; y < src.cols; ++y) {
-      const auto r = radius.at<float>(x, y);
-      const auto xA = std::max<int>(x - r, 0);
-      const auto yA = std::max<int>(y - r, 0);
-      const auto &sA = workImg.at<double>(xA, yA);
-      const auto xB = std::max<int>(x - r, 0);
-      const auto yB = std::min<int>(y + r + 1, nCol - 1);
-      const auto &sB = workImg.at<double>(xB, yB);
-      const auto xC = std::min<int>(x + r + 1, nRow - 1);
-      const auto yC = std::max<int>(y - r, 0);
-      const auto &sC = workImg.at<double>(xC, yC);
-      const auto xD = std::min<int>(x + r + 1, nRow - 1);
-      const auto yD = std::min<int>(y + r + 1, nCol - 1);
-      const auto &sD = workImg.at<double>(xD, yD);
-      dst.at<float>(x, y) = (sD + sA - sB - sC) / ((2 * r + 1) * (2 * r + 1));
-    }
-}
-
-// TODO: fuse all of these separated loops
+  CV_Assert(radius.depth() == CV_32F);
+  radiusSpans.analyze(radius);
+  dynamicMeanFilter(src, dst, radiusSpans);
+}
+
+void GuidedFilter::dynamicMeanFilter(const cv::Mat &src, cv::Mat &dst,
+                                     const RadiusSpans &spans) {
+  CV_Assert((src.type() == CV_8UC1 || src.type() == CV_32FC1) && src.size() == spans.size);
+  // Running sums read rows below the current one, so `src` must not alias `dst`
+  const cv::Mat in = src.data == dst.data ? src.clone() : src;
+  dst.create(in.size(), CV_32FC1);
+
+  if (spans.needsIntegral) {
+    // The table is padded by the largest radius, see \ref sweepMeansImpl
+    workImg.create(in.rows + 1, in.cols + 1 + 2 * cvCeil(spans.maxRadius),
+                   integralDepth(in, std::numeric_limits<uchar>::max()));
+    buildIntegral(in, workImg);
+  }
+
+  parallelSweepMeans(in, workImg, spans, cv::Range(0, in.rows),
+                     [&](int x, const double *means) {
+                       std::copy_n(means, dst.cols, dst.ptr<float>(x));
+                     });
+}
+
+/// \brief Call \p fn with a zero of the element type of \p depth.
+///
+/// The kernels of the filter read and write 8-bit, 16-bit and float images directly.
+///
+/// \param depth [in] CV_8U, CV_16U or CV_32F.
+/// \param fn [in] Generic callable, which takes the zero by value.
+template <typename Fn> static void visitDepth(int depth, Fn &&fn) {
+  switch (depth) {
+  case CV_8U:
+    fn(uchar(0));
+    break;
+  case CV_16U:
+    fn(ushort(0));
+    break;
+  default:
+    CV_Assert(depth == CV_32F);
+    fn(0.f);
+  }
+}
+
+/// Whether the kernels read images of depth \p depth directly.
+static bool isKernelDepth(int depth) {
+  return depth == CV_8U || depth == CV_16U || depth == CV_32F;
+}
+
+/// \brief Depth of the statistics plane of an input.
+///
+/// The statistics of 8-bit images are integers and summed exactly, unless they are stored
+/// in half precision or computed on a subsampled float copy. Those of 16-bit images are
+/// kept in double, see \ref buildStatsRowImpl.
+///
+/// \param depth [in] Depth the kernels read the input at, see \ref isKernelDepth.
+/// \param storageDepth [in] See \ref GFOptions::storageDepth.
+/// \param subsample [in] See \ref GFOptions::subsample.
+static int statsDepthOf(int depth, int storageDepth, int subsample) {
+  if (depth == CV_16U)
+    return CV_64F;
+  if (storageDepth == CV_16F)
+    return CV_16F;
+  return depth == CV_8U && subsample == 1 ? CV_32S : CV_32F;
+}
+
+/// \brief Convert a guidance image to the float guidance of the filter.
+///
+/// Color guidance is converted to gray if \p nGuide is 1. The gray levels of 8-bit images
+/// are rounded, so that their statistics are still integers.
+///
+/// \param guidance [in] Guidance image(1 or 3 channels).
+/// \param dst [out] Guidance image(CV_32F, \p nGuide channels).
+/// \param nGuide [in] Number of guidance channels of the filter.
+/// \param gray [in,out] Scratch buffer for the gray levels.
+static void convertGuide(const cv::Mat &guidance, cv::Mat &dst, int nGuide, cv::Mat &gray) {
+  if (guidance.channels() == nGuide) {
+    guidance.convertTo(dst, CV_32F);
+    return;
+  }
+  cv::cvtColor(guidance, gray, cv::COLOR_BGR2GRAY);
+  gray.convertTo(dst, CV_32F);
+}
+
+/// \brief Hash the contents of an image.
+///
+/// Every step is a bijection of the running hash, so changing any single word of the
+/// image always changes the hash. Rows are hashed in parallel and combined in order.
+///
+/// \param m [in] The image.
+/// \param seed [in] Hash to continue from.
+static uint64_t hashImage(const cv::Mat &m, uint64_t seed) {
+  constexpr uint64_t prime = 0x100000001b3;
+  const auto mix = [](uint64_t h, uint64_t w) { return (h ^ w) * prime; };
+  std::vector<uint64_t> rowHashes(m.rows);
+  const auto rowBytes = m.cols * m.elemSize();
+  cv::parallel_for_(cv::Range(0, m.rows), [&](const cv::Range &rows) {
+    for (int x = rows.start; x < rows.end; ++x) {
+      const auto p = m.ptr<uchar>(x);
+      uint64_t h = 0xcbf29ce484222325;
+      size_t i = 0;
+      for (uint64_t w; i + sizeof(w) <= rowBytes; i += sizeof(w)) {
+        std::memcpy(&w, p + i, sizeof(w));
+        h = mix(h, w);
+      }
+      for (; i < rowBytes; ++i)
+        h = mix(h, p[i]);
+      rowHashes[x] = h;
+    }
+  });
+
+  auto h = mix(mix(seed, m.type()), (uint64_t(m.rows) << 32) | uint64_t(m.cols));
+  for (const auto rowHash : rowHashes)
+    h = mix(h, rowHash);
+  return h;
+}
+
+/// \brief Find the region that has to be filtered.
+///
+/// Pixels with radius 0 keep their input values, so only the bounding box of the pixels
+/// with a positive radius, grown by the largest window radius, has to be evaluated.
+///
+/// \param radii [in] Radius maps of the same size, the region covers all of them.
+/// \param align [in] The region is aligned to multiples of this value.
+/// \param grow [in] Margin around the pixels with a positive radius.
+/// \return The region clipped to the image, or an empty rect if all of the radii are 0.
+static cv::Rect activeRegion(std::span<const cv::Mat> radii, int align, int grow) {
+  cv::Rect box;
+  for (const auto &radius : radii)
+    box |= cv::boundingRect(radius > 0);
+  if (box.empty())
+    return {};
+
+  const auto size = radii.front().size();
+  const auto x0 = std::max(box.x - grow, 0) / align * align;
+  const auto y0 = std::max(box.y - grow, 0) / align * align;
+  const auto x1 = std::min((box.br().x + grow + align - 1) / align * align, size.width);
+  const auto y1 = std::min((box.br().y + grow + align - 1) / align * align, size.height);
+  return {x0, y0, x1 - x0, y1 - y0};
+}
+
+void EpsMap::fillRow(int x, float *dst, int n) const {
+  if (isUniform()) {
+    std::fill_n(dst, n, static_cast<float>(value));
+  } else if (map.depth() == CV_32F) {
+    std::copy_n(map.ptr<float>(x), n, dst);
+  } else {
+    const auto indices = map.ptr<uchar>(x);
+    const auto nEntry = static_cast<int>(table.size());
+    for (int y = 0; y < n; ++y)
+      dst[y] = table[std::min<int>(indices[y], nEntry - 1)];
+  }
+}
+
+int GuidedFilter::outputDepth(const cv::Mat &src) const {
+  if (opts.outputDepth >= 0)
+    return opts.outputDepth;
+  // Inputs the kernels do not read in place are filtered in float
+  return isKernelDepth(src.depth()) ? src.depth() : CV_32F;
+}
+
 void GuidedFilter::dynamicGuidedFilter(const cv::Mat &src, const cv::Mat &guidance,
                                        cv::Mat &dst, const cv::Mat &radius,
                                        const double eps) {
-  checkAndInit(src, guidance);
-  // Split color image to channels
-  cv::split(guideImg, IChannels);
-  // Mean of I & P in each local patch
-  dynamicMeanFilter(inputImg, meanP, radius);
-  dynamicMeanFilter(IChannels[0], meanIChannels[0], radius);
-  dynamicMeanFilter(IChannels[1], meanIChannels[1], radius);
-  dynamicMeanFilter(IChannels[2], meanIChannels[2], radius);
-  // Covariance of I & P in each local patch
-  dynamicMeanFilter(IChannels[0].mul(inputImg), meanIpChannels[0], radius);
-  dynamicMeanFilter(IChannels[1].mul(inputImg), meanIpChannels[1], radius);
-  dynamicMeanFilter(IChannels[2].mul(inputImg), meanIpChannels[2], radius);
-
-  covIpChannels[0] = meanIpChannels[0] - meanIChannels[0].mul(meanP);
-  covIpChannels[1] = meanIpChannels[1] - meanIChannels[1].mul(meanP);
-  covIpChannels[2] = meanIpChannels[2] - meanIChannels[2].mul(meanP);
-
-  // Variance of I in each local patch
-  dynamicMeanFilter(IChannels[0].mul(IChannels[0]), var00, radius);
-  dynamicMeanFilter(IChannels[0].mul(IChannels[1]), var01, radius);
-  dynamicMeanFilter(IChannels[0].mul(IChannels[2]), var02, radius);
-  dynamicMeanFilter(IChannels[1].mul(IChannels[1]), var11, radius);
-  dynamicMeanFilter(IChannels[1].mul(IChannels[2]), var12, radius);
-  dynamicMeanFilter(IChannels[2].mul(IChannels[2]), var22, radius);
-  var00 -= meanIChannels[0].mul(meanIChannels[0]);
-  var01 -= meanIChannels[0].mul(meanIChannels[1]);
-  var02 -= meanIChannels[0].mul(meanIChannels[2]);
-  var11 -= meanIChannels[1].mul(meanIChannels[1]);
-  var12 -= meanIChannels[1].mul(meanIChannels[2]);
-  var22 -= meanIChannels[2].mul(meanIChannels[2]);
-  // Compute a
-  for (size_t x = 0; x < inputImg.rows; ++x)
-    for (size_t y = 0; y < inputImg.cols; ++y) {
-      // Unroll the 3x3 matrix algebra
-      // Sigma Matrix:
-      // s00 s01 s02
-      // s01 s11 s12
-      // s02 s12 s22
-      double s00 = var00.at<float>(x, y);
-      double s01 = var01.at<float>(x, y);
-      double s02 = var02.at<float>(x, y);
-      double s11 = var11.at<float>(x, y);
-      double s12 = var12.at<float>(x, y);
-      double s22 = var22.at<float>(x, y);
-      // Sigma = Sigma + eps * I
-      s00 += eps;
-      s11 += eps;
-      s22 += eps;
-      // Determinant should not be 0
-      double det = s00 * (s22 * s11 - s12 * s12) - s01 * (s22 * s01 - s12 * s02) +
-                   s02 * (s12 * s01 - s11 * s02);
-      CV_Assert(det != 0);
-      // Compute the inverse matrix of Sigma
-      double inv00 = s22 * s11 - s12 * s12;
-      double inv01 = s02 * s12 - s22 * s01;
-      double inv02 = s01 * s12 - s02 * s11;
-      double inv11 = s22 * s00 - s02 * s02;
-      double inv12 = s01 * s02 - s00 * s12;
-      double inv22 = s00 * s11 - s01 * s01;
-      const double detNew = (s00 * inv00) + (s01 * inv01) + (s02 * inv02);
-      inv00 /= detNew;
-      inv01 /= detNew;
-      inv02 /= detNew;
-      inv11 /= detNew;
-      inv12 /= detNew;
-      inv22 /= detNew;
-      // Compute a
-      const double cov0 = covIpChannels[0].at<float>(x, y);
-      const double cov1 = covIpChannels[1].at<float>(x, y);
-      const double cov2 = covIpChannels[2].at<float>(x, y);
-      double a0 = cov0 * inv00 + cov1 * inv01 + cov2 * inv02;
-      double a1 = cov0 * inv01 + cov1 * inv11 + cov2 * inv12;
-      double a2 = cov0 * inv02 + cov1 * inv12 + cov2 * inv22;
-      aChannels[0].at<float>(x, y) = a0;
-      aChannels[1].at<float>(x, y) = a1;
-      aChannels[2].at<float>(x, y) = a2;
-    }
-
-  // Compute b (resue `varXX` to reduce allocations)
-  var22 = meanP - aChannels[0].mul(meanIChannels[0]) - aChannels[1].mul(meanIChannels[1]) -
-          aChannels[2].mul(meanIChannels[2]);
-  // Compute the final result
-  dynamicMeanFilter(aChannels[0], /*meanAChannels[0]=*/var00, radius);
-  dynamicMeanFilter(aChannels[1], /*meanAChannels[1]=*/var01, radius);
-  dynamicMeanFilter(aChannels[2], /*meanAChannels[2]=*/var02, radius);
-  dynamicMeanFilter(/*b=*/var22, /*meanB=*/var11, radius);
-  dst = var00.mul(IChannels[0]) + var01.mul(IChannels[1]) + var02.mul(IChannels[2]) + var11;
+  dynamicGuidedFilter(src, guidance, dst, radius, EpsMap(eps));
+}
+
+void GuidedFilter::dynamicGuidedFilter(const cv::Mat &src, const cv::Mat &guidance,
+                                       cv::Mat &dst, const cv::Mat &radius,
+                                       const EpsMap &eps) {
+  filterBatch(src, guidance, {&dst, 1}, {&radius, 1}, {&eps, 1}, outputDepth(src));
+}
+
+void GuidedFilter::dynamicGuidedFilter(const cv::Mat &src, const cv::Mat &guidance,
+                                       std::vector<cv::Mat> &dsts,
+                                       const std::vector<cv::Mat> &radii,
+                                       const std::vector<EpsMap> &eps) {
+  dsts.resize(radii.size());
+  filterBatch(src, guidance, dsts, radii, eps, outputDepth(src));
+}
+
+void GuidedFilter::filterBatch(const cv::Mat &src, const cv::Mat &guidance,
+                               std::span<cv::Mat> dsts, std::span<const cv::Mat> radii,
+                               std::span<const EpsMap> eps, const int ddepth) {
+  CV_Assert(!radii.empty() && dsts.size() == radii.size() && eps.size() == radii.size());
+  for (size_t k = 0; k < radii.size(); ++k) {
+    CV_Assert(radii[k].type() == CV_32FC1 && radii[k].size() == src.size());
+    CV_Assert(eps[k].isUniform() || eps[k].map.size() == src.size());
+  }
+  CV_Assert(isKernelDepth(ddepth));
+  CV_Assert(opts.subsample >= 1 && (opts.subsample & (opts.subsample - 1)) == 0);
+  CV_Assert(opts.storageDepth == CV_32F || opts.storageDepth == CV_16F);
+
+  // Only filter the region reachable from the pixels with a positive radius in any of the
+  // settings. The fast guided filter needs a few extra pixels for the support of `pyrDown`
+  // & `pyrUp`.
+  double maxRadius = 0;
+  for (const auto &radius : radii) {
+    double settingMax = 0;
+    cv::minMaxLoc(radius, nullptr, &settingMax);
+    maxRadius = std::max(maxRadius, settingMax);
+  }
+  const auto s = opts.subsample;
+  const auto roi = activeRegion(radii, s, cvCeil(maxRadius) + (s == 1 ? 0 : 4 * s));
+  const auto nSetting = radii.size();
+
+  // Summed-area tables are only needed for radius maps with too many distinct radii. The
+  // spans of the subsampled maps of the fast guided filter are not known yet, so it
+  // provides for them.
+  auto needsIntegral = s > 1;
+  for (size_t k = 0; k < nSetting && !needsIntegral; ++k) {
+    RadiusSpans layout;
+    layout.analyze(radii[k](roi));
+    needsIntegral = layout.needsIntegral;
+  }
+
+  // Map the intermediate planes onto shared buffers. The buffers only grow to what is
+  // actually used. The statistics of a batch are read by every setting, so they stay live
+  // until the last one is combined. The planes of the previous call may sit in other
+  // buffers, so none of them is kept.
+  for (int plane = PlaneInput; plane <= PlaneMeanCoefUp; ++plane)
+    planeImg(plane).release();
+  const auto nGuidePlanned = guideChannels(guidance);
+  const auto depth =
+      src.depth() == guidance.depth() && isKernelDepth(src.depth()) ? src.depth() : CV_32F;
+  bufferPlan = planBuffers(src.size(), roi.size(), nGuidePlanned, src.channels(), depth,
+                           static_cast<float>(maxRadius), needsIntegral,
+                           /*keepStatistics=*/nSetting > 1);
+  const auto tileSize = tileSizeFor(roi.size(), nGuidePlanned, src.channels(), depth,
+                                    static_cast<float>(maxRadius), needsIntegral);
+  // Buffers of an image of another size are dropped, so that what the filter holds is
+  // always the footprint of the size of the last call(see \ref memoryReport)
+  if (src.size() != buffersSize) {
+    buffers.clear();
+    buffersSize = src.size();
+  }
+  buffers.resize(bufferPlan.bufferBytes.size());
+
+  // The input and the guidance are read in place, so they must not alias any output
+  const auto aliased = [&](const cv::Mat &m) {
+    return std::any_of(dsts.begin(), dsts.end(),
+                       [&](const cv::Mat &dst) { return dst.data == m.data; });
+  };
+  const cv::Mat in = aliased(src) ? src.clone() : src;
+  const cv::Mat guid = aliased(guidance) ? guidance.clone() : guidance;
+  checkAndInit(in, guid);
+  // Products of wider values overflow half precision. Float images qualify if their values
+  // stay within those of 8-bit ones, e.g. the luminance of an 8-bit image in
+  // \ref applyLumaADF.
+  const auto halfPrecisionRange = [](const cv::Mat &img) {
+    return img.depth() == CV_8U ||
+           (img.depth() == CV_32F && cv::norm(img, cv::NORM_INF) <= 255);
+  };
+  CV_Assert(opts.storageDepth != CV_16F ||
+            (halfPrecisionRange(inputImg) && halfPrecisionRange(guideImg)));
+  const auto nGuide = guideImg.channels();
+  const auto nChannel = inputImg.channels();
+  const auto nCoef = coefCount(nGuide, nChannel);
+  for (auto &dst : dsts)
+    inputImg.convertTo(dst, ddepth);
+  if (roi.empty())
+    return;
+
+  // Crop each setting of a list to a region
+  const auto crop = [](const auto &list, const cv::Rect &region) {
+    std::vector<std::decay_t<decltype(list[0])>> cropped;
+    cropped.reserve(list.size());
+    for (const auto &item : list)
+      cropped.push_back(item(region));
+    return cropped;
+  };
+  const cv::Mat input = inputImg(roi), guide = guideImg(roi);
+  const auto radiusROI = crop(radii, roi);
+  const auto epsROI = crop(eps, roi);
+  auto output = crop(dsts, roi);
+  const auto nCol = roi.width;
+
+  // 8-bit images filtered into 8-bit outputs at full resolution stay in integers, as long
+  // as the window sums of their fixed-point coefficients are exact
+  const auto fixedPoint = s == 1 && input.depth() == CV_8U && ddepth == CV_8U &&
+                          opts.storageDepth == CV_32F && roi.area() <= MaxFixedPixels;
+
+  // The statistics only depend on the input, the guidance and the radius map, so a single
+  // region of a single setting can reuse those of the previous call. The fixed-point path
+  // keeps no centered statistics to cache.
+  auto cache = CacheMode::Off;
+  uint64_t cacheKey = 0;
+  if (opts.cacheStatistics && nSetting == 1 && !fixedPoint &&
+      tileSize >= std::max(roi.width, roi.height)) {
+    const auto seed = (uint64_t(s) << 32) | uint64_t(opts.storageDepth);
+    cacheKey = hashImage(radii[0], hashImage(guideImg, hashImage(inputImg, seed)));
+    cache = cacheKey == statsCacheKey && !statsCache.empty() ? CacheMode::Load
+                                                              : CacheMode::Store;
+    // Invalidate the cache until it is filled
+    if (cache == CacheMode::Store)
+      statsCacheKey = 0;
+  }
+
+  const auto statsDepth = statsDepthOf(input.depth(), opts.storageDepth, s);
+  if (s == 1) {
+    // The final means read the coefficients up to one radius away, which in turn read the
+    // statistics up to one radius further, so tiles overlap by a halo of twice the radius
+    const auto bounds = cv::Rect(0, 0, roi.width, roi.height);
+    const auto halo = 2 * cvCeil(maxRadius);
+    for (int ty = 0; ty < roi.height; ty += tileSize)
+      for (int tx = 0; tx < roi.width; tx += tileSize) {
+        const auto core = cv::Rect(tx, ty, tileSize, tileSize) & bounds;
+        const auto region = cv::Rect(core.x - halo, core.y - halo, core.width + 2 * halo,
+                                     core.height + 2 * halo) &
+                            bounds;
+        auto outputTiles = crop(output, region);
+        filterRegion(input(region), guide(region), crop(radiusROI, region), outputTiles,
+                     core - region.tl(), crop(epsROI, region), statsDepth, fixedPoint,
+                     cache);
+      }
+    if (cache == CacheMode::Store)
+      statsCacheKey = cacheKey;
+    return;
+  }
+
+  // Fast guided filter: solve for a & b on a subsampled copy of the input, the guidance and
+  // the radius map, then upsample the averaged coefficients and apply them at full
+  // resolution.
+  std::vector<cv::Size> pyramidSizes{roi.size()};
+  for (int level = s; level > 1; level /= 2) {
+    const auto &size = pyramidSizes.back();
+    pyramidSizes.emplace_back((size.width + 1) / 2, (size.height + 1) / 2);
+  }
+  const auto sizeDn = pyramidSizes.back();
+  // Only the last level of the pyramid is planned, the levels between are temporaries.
+  // Integer images are widened to float first, so that the pyramid is not rounded.
+  const auto subsample = [&](const cv::Mat &img, cv::Mat &imgDn, int plane) {
+    cv::Mat level = img;
+    if (img.depth() != CV_32F)
+      img.convertTo(level, CV_32F);
+    for (size_t i = 1; i + 1 < pyramidSizes.size(); ++i) {
+      cv::Mat next;
+      cv::pyrDown(level, next, pyramidSizes[i]);
+      level = next;
+    }
+    bindPlane(imgDn, plane, sizeDn, level.type());
+    cv::pyrDown(level, imgDn, sizeDn);
+  };
+  subsample(input, inputImgDn, PlaneInputDn);
+  subsample(guide, guideImgDn, PlaneGuideDn);
+  bindPlane(radiusImgDn, PlaneRadiusDn, sizeDn, CV_32FC1);
+  batchSpans.resize(nSetting);
+  for (size_t k = 0; k < nSetting; ++k) {
+    cv::resize(radiusROI[k], radiusImgDn, sizeDn, 0, 0, cv::INTER_NEAREST);
+    radiusImgDn *= 1.0 / s;
+    batchSpans[k].analyze(radiusImgDn);
+  }
+  if (cache != CacheMode::Load)
+    computeStatistics(inputImgDn, guideImgDn, statsDepth, batchSpans);
+
+  for (size_t k = 0; k < nSetting; ++k) {
+    const auto &spans = batchSpans[k];
+    auto epsDn = epsROI[k];
+    if (!epsDn.isUniform()) {
+      bindPlane(epsImgDn, PlaneEpsDn, sizeDn, epsDn.map.type());
+      cv::resize(epsROI[k].map, epsImgDn, sizeDn, 0, 0, cv::INTER_NEAREST);
+      epsDn.map = epsImgDn;
+    }
+    computeCoefficients(spans, nGuide, nChannel, epsDn, statsDepth, /*fixedPoint=*/false,
+                        cache);
+
+    bindPlane(meanCoefImg, PlaneMeanCoef, sizeDn, CV_32FC(nCoef));
+    const auto nElem = meanCoefImg.cols * nCoef;
+    parallelSweepMeans(coefImg, coefIntegral, spans, cv::Range(0, meanCoefImg.rows),
+                       [&](int x, const double *means) {
+                         std::copy_n(means, nElem, meanCoefImg.ptr<float>(x));
+                       });
+    // Upsample level by level, alternating between the two planes of the mean coefficients
+    auto meanCoef = &meanCoefImg, upsampled = &meanCoefUpImg;
+    auto upsampledPlane = PlaneMeanCoefUp;
+    for (auto level = pyramidSizes.size() - 1; level-- > 0;) {
+      bindPlane(*upsampled, upsampledPlane, pyramidSizes[level], CV_32FC(nCoef));
+      cv::pyrUp(*meanCoef, *upsampled, pyramidSizes[level]);
+      std::swap(meanCoef, upsampled);
+      upsampledPlane = upsampledPlane == PlaneMeanCoefUp ? PlaneMeanCoef : PlaneMeanCoefUp;
+    }
+
+    const auto &radius = radiusROI[k];
+    auto &out = output[k];
+    visitDepth(guide.depth(), [&](auto zeroI) {
+      visitDepth(out.depth(), [&](auto zeroD) {
+        using P = decltype(zeroI);
+        using D = decltype(zeroD);
+        cv::parallel_for_(cv::Range(0, roi.height), [&](const cv::Range &rows) {
+          for (int x = rows.start; x < rows.end; ++x)
+            combineDenseRow(meanCoef->ptr<float>(x), guide.ptr<P>(x), radius.ptr<float>(x),
+                            nCol, nGuide, nChannel, out.ptr<D>(x));
+        });
+      });
+    });
+  }
+  if (cache == CacheMode::Store)
+    statsCacheKey = cacheKey;
+}
+
+void GuidedFilter::filterRegion(const cv::Mat &input, const cv::Mat &guide,
+                                std::span<const cv::Mat> radii, std::span<cv::Mat> outputs,
+                                const cv::Rect &core, std::span<const EpsMap> eps,
+                                const int statsDepth, const bool fixedPoint,
+                                const CacheMode cache) {
+  const auto nGuide = guide.channels();
+  const auto nChannel = input.channels();
+
+  // The radius map of a setting is shared by all of its mean filters, and the statistics
+  // by all of the settings
+  batchSpans.resize(radii.size());
+  for (size_t k = 0; k < radii.size(); ++k)
+    batchSpans[k].analyze(radii[k]);
+  if (cache != CacheMode::Load)
+    computeStatistics(input, guide, statsDepth, batchSpans);
+
+  for (size_t k = 0; k < radii.size(); ++k) {
+    const auto &spans = batchSpans[k];
+    auto &output = outputs[k];
+    computeCoefficients(spans, nGuide, nChannel, eps[k], statsDepth, fixedPoint, cache);
+
+    // Pass 3: average a & b over the same windows and compute the final result
+    if (fixedPoint) {
+      parallelSweepMeans</*Sums=*/true>(
+          coefImg, coefIntegral, spans, cv::Range(core.y, core.br().y),
+          [&](int x, const int64_t *sums, const int *areas) {
+            combineFixedRow(sums, areas, guide.ptr<uchar>(x), spans.row(x), core.x,
+                            core.br().x, nGuide, nChannel, output.ptr<uchar>(x));
+          });
+      continue;
+    }
+    visitDepth(guide.depth(), [&](auto zeroI) {
+      visitDepth(output.depth(), [&](auto zeroD) {
+        using P = decltype(zeroI);
+        using D = decltype(zeroD);
+        parallelSweepMeans(coefImg, coefIntegral, spans, cv::Range(core.y, core.br().y),
+                           [&](int x, const double *means) {
+                             combineRow(means, guide.ptr<P>(x), spans.row(x), core.x,
+                                        core.br().x, nGuide, nChannel, output.ptr<D>(x));
+                           });
+      });
+    });
+  }
+}
+
+void GuidedFilter::computeStatistics(const cv::Mat &input, const cv::Mat &guide,
+                                     const int statsDepth,
+                                     std::span<const RadiusSpans> spans) {
+  CV_Assert(guide.size() == input.size() && guide.depth() == input.depth());
+  CV_Assert(statsDepth == CV_32F || statsDepth == CV_32S || statsDepth == CV_16F ||
+            statsDepth == CV_64F);
+  const auto nRow = input.rows, nCol = input.cols;
+  const auto nGuide = guide.channels();
+  const auto nChannel = input.channels();
+  const auto nStat = statCount(nGuide, nChannel);
+
+  // Pass 1: build the product planes(and their summed-area tables)
+  bindPlane(statsImg, PlaneStats, input.size(), CV_MAKETYPE(statsDepth, nStat));
+  visitDepth(input.depth(), [&](auto zero) {
+    using P = decltype(zero);
+    cv::parallel_for_(cv::Range(0, nRow), [&](const cv::Range &rows) {
+      for (int x = rows.start; x < rows.end; ++x) {
+        const auto pRow = input.ptr<P>(x);
+        const auto IRow = guide.ptr<P>(x);
+        if (statsDepth == CV_32S)
+          buildStatsRow(pRow, IRow, statsImg.ptr<int>(x), nCol, nGuide, nChannel);
+        else if (statsDepth == CV_16F)
+          buildStatsRow(pRow, IRow, statsImg.ptr<cv::float16_t>(x), nCol, nGuide,
+                        nChannel);
+        else if (statsDepth == CV_64F)
+          buildStatsRow(pRow, IRow, statsImg.ptr<double>(x), nCol, nGuide, nChannel);
+        else
+          buildStatsRow(pRow, IRow, statsImg.ptr<float>(x), nCol, nGuide, nChannel);
+      }
+    });
+  });
+  // The table is padded by the largest radius of the layouts that read it
+  auto pad = -1;
+  for (const auto &layout : spans)
+    if (layout.needsIntegral)
+      pad = std::max(pad, cvCeil(layout.maxRadius));
+  if (pad >= 0) {
+    // Products of 8-bit values are at most 255^2
+    const auto depth = integralDepth(statsImg, 255.0 * 255.0);
+    bindPlane(statsIntegral, PlaneStatsIntegral, {nCol + 1 + 2 * pad, nRow + 1},
+              CV_MAKETYPE(depth, nStat));
+    buildIntegral(statsImg, statsIntegral);
+  }
+}
+
+void GuidedFilter::computeCoefficients(const RadiusSpans &spans, const int nGuide,
+                                       const int nChannel, const EpsMap &eps,
+                                       const int statsDepth, const bool fixedPoint,
+                                       const CacheMode cache) {
+  CV_Assert(statsDepth == CV_32F || statsDepth == CV_32S || statsDepth == CV_16F ||
+            statsDepth == CV_64F);
+  CV_Assert(!fixedPoint || (statsDepth == CV_32S && cache == CacheMode::Off));
+  const auto nRow = spans.size.height, nCol = spans.size.width;
+  const auto nStat = statCount(nGuide, nChannel);
+  const auto nCoef = coefCount(nGuide, nChannel);
+  // Half-precision statistics come with half-precision coefficients, and the fixed-point
+  // path with integer ones
+  const auto coefDepth = fixedPoint ? CV_32S : statsDepth == CV_16F ? CV_16F : CV_32F;
+
+  // Solve for a & b of the x-th row from the windowed means of its statistics, or from
+  // its centered statistics in the cache if `means` is null
+  const auto solveRow = [&](const double *means, int x, cv::Mat &solveRows,
+                            cv::Mat &coefRows) {
+    const auto centered = cache == CacheMode::Off ? nullptr : statsCache.ptr<float>(x);
+    if (coefDepth == CV_16F)
+      solveCoefficients(means, coefImg.ptr<cv::float16_t>(x), nCol, nGuide, nChannel, eps,
+                        x, solveRows, coefRows, centered);
+    else
+      solveCoefficients(means, coefImg.ptr<float>(x), nCol, nGuide, nChannel, eps, x,
+                        solveRows, coefRows, centered);
+  };
+
+  bindPlane(coefImg, PlaneCoef, spans.size, CV_MAKETYPE(coefDepth, nCoef));
+  if (cache == CacheMode::Load) {
+    // Only eps has changed since the statistics were cached, so the passes over them are
+    // skipped
+    CV_Assert(statsCache.size() == cv::Size(nStat * nCol, nRow));
+    cv::parallel_for_(cv::Range(0, nRow), [&](const cv::Range &rows) {
+      cv::Mat solveRows, coefRows;
+      for (int x = rows.start; x < rows.end; ++x)
+        solveRow(nullptr, x, solveRows, coefRows);
+    });
+  } else {
+    CV_Assert(statsImg.size() == spans.size && statsImg.channels() == nStat &&
+              statsImg.depth() == statsDepth);
+    if (cache == CacheMode::Store)
+      statsCache.create(nRow, nStat * nCol, CV_32FC1);
+
+    if (fixedPoint) {
+      // Pass 2 in integers: solve for a & b from the exact window sums
+      cv::parallel_for_(
+          cv::Range(0, nRow),
+          [&](const cv::Range &stripe) {
+            std::vector<float> epsRow(nCol);
+            sweepSums(statsImg, statsIntegral, spans, stripe,
+                      [&](int x, const int64_t *sums, const int *areas) {
+                        eps.fillRow(x, epsRow.data(), nCol);
+                        solveFixedRow(sums, areas, coefImg.ptr<int>(x), nCol, nGuide,
+                                      nChannel, epsRow.data());
+                      });
+          },
+          stripeCount(spans));
+    } else {
+      // Pass 2: evaluate the windowed means and solve for a & b row by row. The inverse of
+      // Sigma only depends on the guidance, so it is shared by all of the input channels.
+      cv::parallel_for_(
+          cv::Range(0, nRow),
+          [&](const cv::Range &stripe) {
+            // Scratch rows of this stripe
+            cv::Mat solveRows, coefRows;
+            sweepMeans(statsImg, statsIntegral, spans, stripe,
+                       [&](int x, const double *means) {
+                         solveRow(means, x, solveRows, coefRows);
+                       });
+          },
+          stripeCount(spans));
+    }
+  }
+
+  // Fixed-point coefficients are summed exactly, see \ref FixedMaxB
+  if (spans.needsIntegral) {
+    bindPlane(coefIntegral, PlaneCoefIntegral,
+              {nCol + 1 + 2 * cvCeil(spans.maxRadius), nRow + 1}, CV_64FC(nCoef));
+    buildIntegral(coefImg, coefIntegral);
+  }
+}
+
+/// \brief The most recent rows of a multi-channel summed-area table.
+///
+/// The means of row x only read the table rows `[x - ceil(r), x + floor(r) + 1]`, so a ring
+/// of `2 * ceil(rmax) + 2` rows is enough to stream a plane row by row. The rows are padded
+/// by `ceil(rmax)` columns, see \ref accumulateIntegralRow.
+class IntegralRing {
+public:
+  /// \brief Allocate an empty table.
+  /// \param nCol [in] Number of columns of the plane.
+  /// \param K [in] Number of channels of the plane.
+  /// \param nRing [in] Number of table rows to keep.
+  /// \param pad [in] Number of padding columns on either side, at least the largest radius.
+  void create(int nCol, int K, int nRing, int pad) {
+    this->nCol = nCol;
+    this->K = K;
+    this->pad = pad;
+    table.create(nRing, (nCol + 1 + 2 * pad) * K, CV_64FC1);
+    table.row(0).setTo(0);
+    nRow = 0;
+  }
+
+  /// Append the next row of the plane.
+  template <typename T>
+  void push(const T *src) {
+    const auto sPrev = table.ptr<double>(nRow % table.rows);
+    ++nRow;
+    accumulateIntegralRow(src, sPrev, table.ptr<double>(nRow % table.rows), nCol, K, pad);
+  }
+
+  /// \brief Evaluate the windowed means of the x-th row of the plane.
+  /// \param x [in] Row index, the rows the windows read have to be pushed and still kept.
+  /// \param nPlaneRow [in] Number of rows of the whole plane.
+  /// \param spans [in] Runs of the x-th row of the radius map.
+  /// \param invWidths [in] Reciprocals of the window widths, see
+  ///                       \ref RadiusSpans::invWidths.
+  /// \param mRow [out] Interleaved means of the row.
+  void means(int x, int nPlaneRow, std::span<const RadiusSpan> spans,
+             const double *invWidths, double *mRow) const {
+    for (const auto &span : spans) {
+      const auto r = span.radius;
+      const auto before = cvCeil(r), after = cvFloor(r);
+      CV_DbgAssert(before <= pad);
+      const auto top = std::max(x - before, 0), bottom = std::min(x + after + 1, nPlaneRow);
+      const auto invHeight = invWidths[bottom - top];
+      const auto sTop = row(top) + pad * K, sBottom = row(bottom) + pad * K;
+      forEachWindow(span.begin, span.end, before, after, nCol, invWidths,
+                    [&](int y, double invWidth) {
+                      const auto iL = (y - before) * K;
+                      const auto iR = (y + after + 1) * K;
+                      const auto invArea = invHeight * invWidth;
+                      for (int k = 0; k < K; ++k)
+                        mRow[y * K + k] = (sBottom[iR + k] + sTop[iL + k] - sTop[iR + k] -
+                                           sBottom[iL + k]) *
+                                          invArea;
+                    });
+    }
+  }
+
+private:
+  /// Row x of the table, which has to be one of the last rows kept.
+  const double *row(int x) const { return table.ptr<double>(x % table.rows); }
+
+  cv::Mat table;
+  int nCol = 0;
+  int K = 0;
+  int pad = 0;
+  /// Number of rows of the plane pushed so far.
+  int nRow = 0;
+};
+
+void GuidedFilter::streamGuidedFilter(cv::Size size, float maxRadius, const RowReader &read,
+                                      const RowWriter &write, const double eps) {
+  CV_Assert(!size.empty() && maxRadius >= 0);
+  const auto nRow = size.height, nCol = size.width;
+  const auto R = cvCeil(maxRadius);
+  // Coefficients of row x need the statistics up to row x + R, the output of row x needs
+  // the coefficients up to row x + R, i.e. the input up to row x + 2R
+  const auto nInputRing = 2 * R + 1;
+  const auto nIntegralRing = 2 * R + 2;
+
+  cv::Mat srcRow, guideRow, radiusRow;
+  cv::Mat inputRing, guideRing, radiusRing;
+  cv::Mat statsRow, coefRow, dstRow, solveRows, coefRows, grayRow;
+  IntegralRing statsRing, coefRing;
+  RadiusSpans rowSpans;
+  std::vector<double> means;
+  int nGuide = 0, nChannel = 0;
+  auto statsDepth = CV_32F;
+  for (int x = 0; x < nRow + 2 * R; ++x) {
+    if (x < nRow) {
+      read(x, srcRow, guideRow, radiusRow);
+      CV_Assert(srcRow.size() == cv::Size(nCol, 1) && guideRow.size() == srcRow.size() &&
+                radiusRow.size() == srcRow.size());
+      CV_Assert((guideRow.channels() == 1 || guideRow.channels() == 3) &&
+                radiusRow.type() == CV_32FC1);
+      const auto rowDepth = statsDepthOf(
+          srcRow.depth() == guideRow.depth() ? srcRow.depth() : CV_32F, CV_32F, 1);
+      if (x == 0) {
+        CV_Assert(srcRow.channels() == 1 || srcRow.channels() == 3);
+        nChannel = srcRow.channels();
+        nGuide = guideChannels(guideRow);
+        // The statistics of 8-bit images are integers and summed exactly, those of 16-bit
+        // images are exact in double
+        statsDepth = rowDepth;
+        const auto nStat = statCount(nGuide, nChannel);
+        const auto nCoef = coefCount(nGuide, nChannel);
+        inputRing.create(nInputRing, nCol, CV_32FC(nChannel));
+        guideRing.create(nInputRing, nCol, CV_32FC(nGuide));
+        radiusRing.create(nInputRing, nCol, CV_32FC1);
+        statsRow.create(1, nCol, CV_MAKETYPE(statsDepth, nStat));
+        coefRow.create(1, nCol, CV_32FC(nCoef));
+        statsRing.create(nCol, nStat, nIntegralRing, R);
+        coefRing.create(nCol, nCoef, nIntegralRing, R);
+        means.resize(static_cast<size_t>(nCol) * nStat);
+      }
+      CV_Assert(srcRow.channels() == nChannel && guideChannels(guideRow) == nGuide &&
+                rowDepth == statsDepth);
+      double rowMaxRadius = 0;
+      cv::minMaxLoc(radiusRow, nullptr, &rowMaxRadius);
+      CV_Assert(rowMaxRadius <= maxRadius);
+
+      const auto i = x % nInputRing;
+      cv::Mat inputSlot = inputRing.row(i), guideSlot = guideRing.row(i),
+              radiusSlot = radiusRing.row(i);
+      srcRow.convertTo(inputSlot, CV_32F);
+      convertGuide(guideRow, guideSlot, nGuide, grayRow);
+      radiusRow.copyTo(radiusSlot);
+      if (statsDepth == CV_32S) {
+        buildStatsRow(inputRing.ptr<float>(i), guideRing.ptr<float>(i), statsRow.ptr<int>(),
+                      nCol, nGuide, nChannel);
+        statsRing.push(statsRow.ptr<int>());
+      } else if (statsDepth == CV_64F) {
+        buildStatsRow(inputRing.ptr<float>(i), guideRing.ptr<float>(i),
+                      statsRow.ptr<double>(), nCol, nGuide, nChannel);
+        statsRing.push(statsRow.ptr<double>());
+      } else {
+        buildStatsRow(inputRing.ptr<float>(i), guideRing.ptr<float>(i),
+                      statsRow.ptr<float>(), nCol, nGuide, nChannel);
+        statsRing.push(statsRow.ptr<float>());
+      }
+    }
+
+    // Solve for a & b of the row whose statistics windows are complete
+    if (const auto xc = x - R; xc >= 0 && xc < nRow) {
+      rowSpans.analyze(radiusRing.row(xc % nInputRing));
+      statsRing.means(xc, nRow, rowSpans.row(0), rowSpans.invWidths.data(),
+                      means.data());
+      solveCoefficients(means.data(), coefRow.ptr<float>(), nCol, nGuide, nChannel,
+                        EpsMap(eps), xc, solveRows, coefRows);
+      coefRing.push(coefRow.ptr<float>());
+    }
+
+    // Emit the row whose coefficient windows are complete
+    if (const auto xo = x - 2 * R; xo >= 0 && xo < nRow) {
+      const auto i = xo % nInputRing;
+      rowSpans.analyze(radiusRing.row(i));
+      coefRing.means(xo, nRow, rowSpans.row(0), rowSpans.invWidths.data(),
+                     means.data());
+      inputRing.row(i).copyTo(dstRow);
+      combineRow(means.data(), guideRing.ptr<float>(i), rowSpans.row(0), 0, nCol, nGuide,
+                 nChannel, dstRow.ptr<float>());
+      write(xo, dstRow);
+    }
+  }
 }
 
 void GuidedFilter::checkAndInit(const cv::Mat &src, const cv::Mat &guidance) {
-  CV_Assert(guidance.channels() == 3 && src.channels() == 1);
+  CV_Assert((guidance.channels() == 1 || guidance.channels() == 3) &&
+            (src.channels() == 1 || src.channels() == 3));
+  CV_Assert(guidance.size() == src.size());
 
-  src.copyTo(inputImg);
-  if (inputImg.depth() != CV_32F)
-    inputImg.convertTo(inputImg, CV_32F);
+  // The kernels read the input and the guidance in place if they share a depth they
+  // support, anything else is converted to float
+  const auto nGuide = guideChannels(guidance);
+  const auto depth = src.depth();
+  if (depth == guidance.depth() && isKernelDepth(depth)) {
+    inputImg = src;
+    if (guidance.channels() == nGuide) {
+      guideImg = guidance;
+    } else {
+      bindPlane(guideImg, PlaneGuide, guidance.size(), CV_MAKETYPE(depth, nGuide));
+      cv::cvtColor(guidance, guideImg, cv::COLOR_BGR2GRAY);
+    }
+    return;
+  }
 
-  guidance.copyTo(guideImg);
-  if (guideImg.depth() != CV_32F)
-    guideImg.convertTo(guideImg, CV_32F);
+  bindPlane(inputImg, PlaneInput, src.size(), CV_32FC(src.channels()));
+  src.convertTo(inputImg, CV_32F);
+  bindPlane(guideImg, PlaneGuide, guidance.size(), CV_32FC(nGuide));
+  convertGuide(guidance, guideImg, nGuide, workImg);
+}
 
-  // Re-init work arrays if the input image size got changed.
-  const auto sizeSrc = src.size();
+void BufferPlan::add(const char *name, size_t bytes, int first, int last) {
+  planes.push_back({name, bytes, first, last, /*buffer=*/-1});
+}
+
+void BufferPlan::assign() {
+  std::vector<int> order(planes.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::ranges::stable_sort(order, std::greater{}, [&](int i) { return planes[i].bytes; });
+
+  bufferBytes.clear();
+  for (const auto i : order) {
+    auto &plane = planes[i];
+    const auto overlaps = [&](const Plane &other) {
+      return other.buffer >= 0 && other.first <= plane.last && plane.first <= other.last;
+    };
+    int buffer = 0;
+    for (; buffer < static_cast<int>(bufferBytes.size()); ++buffer)
+      if (std::ranges::none_of(planes, [&](const Plane &other) {
+            return other.buffer == buffer && overlaps(other);
+          }))
+        break;
+    if (buffer == static_cast<int>(bufferBytes.size()))
+      bufferBytes.push_back(0);
+    plane.buffer = buffer;
+    bufferBytes[buffer] = std::max(bufferBytes[buffer], plane.bytes);
+  }
+}
 
-  if (meanP.size() != sizeSrc)
-    meanP = cv::Mat::zeros(sizeSrc, CV_32FC1);
+size_t BufferPlan::plannedBytes() const {
+  return std::accumulate(bufferBytes.begin(), bufferBytes.end(), size_t(0));
+}
 
-  if (meanIChannels[0].size() != sizeSrc) {
-    meanIChannels[0] = cv::Mat::zeros(sizeSrc, CV_32FC1);
-    meanIChannels[1] = cv::Mat::zeros(sizeSrc, CV_32FC1);
-    meanIChannels[2] = cv::Mat::zeros(sizeSrc, CV_32FC1);
+size_t BufferPlan::liveBytes() const {
+  size_t peak = 0;
+  for (const auto &plane : planes) {
+    // The live bytes only change at the first pass of a plane
+    size_t bytes = 0;
+    for (const auto &other : planes)
+      if (other.first <= plane.first && plane.first <= other.last)
+        bytes += other.bytes;
+    peak = std::max(peak, bytes);
   }
+  return peak;
+}
+
+BufferPlan GuidedFilter::planBuffers(cv::Size size, int nChannel, float maxRadius,
+                                     bool needsIntegral) const {
+  return planBuffers(size, size, opts.grayGuidance ? 1 : 3, nChannel, CV_8U, maxRadius,
+                     needsIntegral, /*keepStatistics=*/false);
+}
+
+BufferPlan GuidedFilter::planBuffers(cv::Size size, cv::Size roi, int nGuide, int nChannel,
+                                     int depth, float maxRadius, bool needsIntegral,
+                                     bool keepStatistics) const {
+  const auto bytesOf = [](cv::Size planeSize, int type) {
+    return static_cast<size_t>(planeSize.area()) * CV_ELEM_SIZE(type);
+  };
+  const auto nStat = statCount(nGuide, nChannel);
+  const auto nCoef = coefCount(nGuide, nChannel);
+  const auto fast = opts.subsample > 1;
 
-  if (meanIpChannels[0].size() != sizeSrc) {
-    meanIpChannels[0] = cv::Mat::zeros(sizeSrc, CV_32FC1);
-    meanIpChannels[1] = cv::Mat::zeros(sizeSrc, CV_32FC1);
-    meanIpChannels[2] = cv::Mat::zeros(sizeSrc, CV_32FC1);
+  // Size of the statistics and coefficient planes: the largest tile with its halo, or the
+  // subsampled region
+  auto work = roi;
+  const auto tileSize = tileSizeFor(roi, nGuide, nChannel, depth, maxRadius, needsIntegral);
+  const auto tiled = tileSize < std::max(roi.width, roi.height);
+  if (tiled) {
+    const auto halo = 2 * cvCeil(maxRadius);
+    work = {std::min(tileSize + 2 * halo, roi.width),
+            std::min(tileSize + 2 * halo, roi.height)};
   }
+  for (int level = opts.subsample; level > 1; level /= 2)
+    work = {(work.width + 1) / 2, (work.height + 1) / 2};
+  const auto sizeDn = fast ? work : cv::Size();
+  // Summed-area tables are padded by the largest radius on either side
+  const auto pad = cvCeil(maxRadius / opts.subsample);
+  const auto integral =
+      needsIntegral ? cv::Size(work.width + 1 + 2 * pad, work.height + 1) : cv::Size();
+  // Integer statistics and coefficients are as wide as float ones, and their tables at most
+  // as wide
+  const auto statsDepth = statsDepthOf(depth, opts.storageDepth, opts.subsample);
+  const auto coefDepth = opts.storageDepth;
+  const auto lastCoef = fast ? PassMeans : PassCombine;
+  const auto lastStats = keepStatistics ? PassCombine : PassSolve;
 
-  if (var00.size() != sizeSrc) {
-    var00 = cv::Mat::zeros(sizeSrc, CV_32FC1);
-    var01 = cv::Mat::zeros(sizeSrc, CV_32FC1);
-    var02 = cv::Mat::zeros(sizeSrc, CV_32FC1);
-    var11 = cv::Mat::zeros(sizeSrc, CV_32FC1);
-    var12 = cv::Mat::zeros(sizeSrc, CV_32FC1);
-    var22 = cv::Mat::zeros(sizeSrc, CV_32FC1);
+  BufferPlan plan;
+  // The input and the guidance are only bound if they have to be converted(see
+  // \ref checkAndInit), they are provided for as float. Every tile reads the input,
+  // otherwise only the statistics(or the subsampling) do.
+  plan.add("input", bytesOf(size, CV_32FC(nChannel)), PassInit,
+           tiled ? PassCombine : fast ? PassDownsample : PassStats);
+  plan.add("guidance", bytesOf(size, CV_32FC(nGuide)), PassInit, PassCombine);
+  plan.add("subsampled input", bytesOf(sizeDn, CV_32FC(nChannel)), PassDownsample,
+           PassStats);
+  plan.add("subsampled guidance", bytesOf(sizeDn, CV_32FC(nGuide)), PassDownsample,
+           PassStats);
+  plan.add("subsampled radius", bytesOf(sizeDn, CV_32FC1), PassDownsample, PassStats);
+  plan.add("subsampled eps", bytesOf(sizeDn, CV_32FC1), PassDownsample, PassSolve);
+  plan.add("statistics", bytesOf(work, CV_MAKETYPE(statsDepth, nStat)), PassStats,
+           lastStats);
+  plan.add("statistics SAT", bytesOf(integral, CV_64FC(nStat)), PassStats, lastStats);
+  plan.add("coefficients", bytesOf(work, CV_MAKETYPE(coefDepth, nCoef)), PassSolve,
+           lastCoef);
+  plan.add("coefficient SAT", bytesOf(integral, CV_64FC(nCoef)), PassCoefIntegral,
+           lastCoef);
+  plan.add("mean coefficients", fast ? bytesOf(roi, CV_32FC(nCoef)) : 0, PassMeans,
+           PassCombine);
+  plan.add("upsampled mean coefficients", fast ? bytesOf(roi, CV_32FC(nCoef)) : 0,
+           PassMeans, PassCombine);
+  plan.assign();
+  return plan;
+}
+
+int GuidedFilter::tileSizeFor(cv::Size roi, int nGuide, int nChannel, int depth,
+                              float maxRadius, bool needsIntegral) const {
+  const auto whole = std::max(roi.width, roi.height);
+  if (opts.subsample > 1)
+    return whole;
+  if (opts.tileSize > 0)
+    return opts.tileSize;
+  // The cached statistics cover the whole region anyway
+  if (opts.tileBudget == 0 || opts.cacheStatistics)
+    return whole;
+
+  // Bytes of the statistics and coefficient planes of a square region and of their
+  // summed-area tables, as planned by \ref planBuffers
+  const auto nStat = static_cast<size_t>(statCount(nGuide, nChannel));
+  const auto nPlane = nStat + coefCount(nGuide, nChannel);
+  const auto planeBytes =
+      nStat * CV_ELEM_SIZE(statsDepthOf(depth, opts.storageDepth, /*subsample=*/1)) +
+      (nPlane - nStat) * CV_ELEM_SIZE(opts.storageDepth);
+  const auto tableBytes = needsIntegral ? nPlane * sizeof(double) : 0;
+  const auto pad = cvCeil(maxRadius);
+  const auto workingSet = [&](int side) {
+    const auto area = static_cast<size_t>(side) * side;
+    const auto tableArea = static_cast<size_t>(side + 1 + 2 * pad) * (side + 1);
+    return area * planeBytes + tableArea * tableBytes;
+  };
+  const auto pixelBytes = planeBytes + tableBytes;
+  auto side = static_cast<int>(std::sqrt(double(opts.tileBudget) / double(pixelBytes)));
+  while (side > 0 && workingSet(side) > opts.tileBudget)
+    --side;
+
+  const auto halo = 2 * cvCeil(maxRadius);
+  const auto tileSize = std::max({side - 2 * halo, 2 * halo, MinTileSize});
+  return std::min(tileSize, whole);
+}
+
+cv::Mat &GuidedFilter::planeImg(int plane) {
+  switch (plane) {
+  case PlaneInput:
+    return inputImg;
+  case PlaneGuide:
+    return guideImg;
+  case PlaneInputDn:
+    return inputImgDn;
+  case PlaneGuideDn:
+    return guideImgDn;
+  case PlaneRadiusDn:
+    return radiusImgDn;
+  case PlaneEpsDn:
+    return epsImgDn;
+  case PlaneStats:
+    return statsImg;
+  case PlaneStatsIntegral:
+    return statsIntegral;
+  case PlaneCoef:
+    return coefImg;
+  case PlaneCoefIntegral:
+    return coefIntegral;
+  case PlaneMeanCoef:
+    return meanCoefImg;
+  default:
+    CV_Assert(plane == PlaneMeanCoefUp);
+    return meanCoefUpImg;
   }
+}
 
-  if (aChannels[0].size() != sizeSrc) {
-    aChannels[0] = cv::Mat::zeros(sizeSrc, CV_32FC1);
-    aChannels[1] = cv::Mat::zeros(sizeSrc, CV_32FC1);
-    aChannels[2] = cv::Mat::zeros(sizeSrc, CV_32FC1);
+void GuidedFilter::bindPlane(cv::Mat &m, int plane, cv::Size size, int type) {
+  if (plane >= static_cast<int>(bufferPlan.planes.size())) {
+    m.create(size, type);
+    return;
+  }
+  const auto bytes = static_cast<size_t>(size.area()) * CV_ELEM_SIZE(type);
+  const auto index = bufferPlan.planes[plane].buffer;
+  auto &buffer = buffers[index];
+  if (buffer.total() < bytes) {
+    // The other planes of the buffer would be left pointing at the freed storage
+    for (size_t p = 0; p < bufferPlan.planes.size(); ++p)
+      if (bufferPlan.planes[p].buffer == index)
+        planeImg(static_cast<int>(p)).release();
+    // Rows of 4 KiB keep the dimensions of large buffers within int
+    constexpr int rowBytes = 4096;
+    buffer.create(static_cast<int>((bytes + rowBytes - 1) / rowBytes), rowBytes, CV_8UC1);
   }
+  m = cv::Mat(size, type, buffer.data);
+}
+
+size_t GuidedFilter::allocatedBytes() const {
+  const auto bytesOf = [](const cv::Mat &m) { return m.total() * m.elemSize(); };
+  // The planned planes live in `buffers`, the remaining members are allocated on their own
+  auto bytes = bytesOf(workImg) + bytesOf(statsCache);
+  for (const auto &buffer : buffers)
+    bytes += bytesOf(buffer);
+  for (const auto &m : radiusImgs)
+    bytes += bytesOf(m);
+  for (const auto &m : epsImgs)
+    bytes += bytesOf(m);
+  return bytes;
+}
+
+MemoryReport GuidedFilter::memoryReport(cv::Size size, int nChannel, float maxRadius,
+                                        bool needsIntegral) const {
+  const auto plan = planBuffers(size, nChannel, maxRadius, needsIntegral);
+  if (size != buffersSize)
+    return {plan.plannedBytes(), plan.liveBytes(), /*actualBytes=*/0, cv::Size()};
+  return {plan.plannedBytes(), plan.liveBytes(), allocatedBytes(), buffersSize};
 }
 
 void GuidedFilter::applyADF(const cv::Mat &mask, const cv::Mat &guidance, const cv::Mat &src,
                           cv::Mat &dst) {
-  // constexpr auto alphaRadius = 10;
-  // constexpr auto betaRadius = 10;
-
-  // const double nSpots = std::ranges::count_if(contours, isBlemish);
-  // const double spotFactor = nSpots / 60;
-  // const double alphaEps = 5 * spotFactor;
-  // const double betaEps = 100 * spotFactor;
-  // const double eps = alphaEps * nSpots + betaEps;
-
-  const double eps = opts.eps;
-  if (radiusImg.size() != src.size())
-    radiusImg = cv::Mat::ones(src.size(), CV_8UC1);
-
-  cv::bitwise_and(radiusImg, mask, radiusImg);
-  radiusImg.convertTo(radiusImg, CV_32F);
-  radiusImg *= opts.radius4skin;
-
-  CV_Assert(src.channels() == 3);
-  cv::split(src, inputChannels);
-  dynamicGuidedFilter(inputChannels[0], guidance, outputChannels[0], radiusImg, eps);
-  dynamicGuidedFilter(inputChannels[1], guidance, outputChannels[1], radiusImg, eps);
-  dynamicGuidedFilter(inputChannels[2], guidance, outputChannels[2], radiusImg, eps);
-  cv::merge(outputChannels, dst);
+  applyADF(mask, guidance, src, dst, cv::Mat(), cv::Mat());
+}
+
+void GuidedFilter::applyADF(const cv::Mat &mask, const cv::Mat &guidance,
+                            const cv::Mat &src, cv::Mat &dst, const cv::Mat &radiusScale,
+                            const cv::Mat &epsScale) {
+  const ADFStrength strength(1, opts.eps);
+  applyADFBatch(mask, guidance, src, {&strength, 1}, {&dst, 1}, radiusScale, epsScale);
+}
+
+void GuidedFilter::applyADF(const cv::Mat &mask, const cv::Mat &guidance,
+                            const cv::Mat &src, const std::vector<ADFStrength> &strengths,
+                            std::vector<cv::Mat> &dsts, const cv::Mat &radiusScale,
+                            const cv::Mat &epsScale) {
+  dsts.resize(strengths.size());
+  applyADFBatch(mask, guidance, src, strengths, dsts, radiusScale, epsScale);
+}
+
+void GuidedFilter::applyADFBatch(const cv::Mat &mask, const cv::Mat &guidance,
+                                 const cv::Mat &src, std::span<const ADFStrength> strengths,
+                                 std::span<cv::Mat> dsts, const cv::Mat &radiusScale,
+                                 const cv::Mat &epsScale) {
+  CV_Assert(src.channels() == 3 && mask.type() == CV_8UC1 && mask.size() == src.size());
+  CV_Assert(radiusScale.empty() ||
+            (radiusScale.type() == CV_32FC1 && radiusScale.size() == src.size()));
+  CV_Assert(epsScale.empty() ||
+            (epsScale.type() == CV_32FC1 && epsScale.size() == src.size()));
+  CV_Assert(!strengths.empty() && dsts.size() == strengths.size());
+
+  const auto nStrength = strengths.size();
+  radiusImgs.resize(nStrength);
+  epsImgs.resize(nStrength);
+  std::vector<EpsMap> eps;
+  for (size_t k = 0; k < nStrength; ++k) {
+    // The same products as a single call with the scaled radius
+    const auto radius4skin = opts.radius4skin * strengths[k].radiusScale;
+    auto &radiusImg = radiusImgs[k];
+    radiusImg.create(src.size(), CV_32FC1);
+    radiusImg.setTo(0);
+    radiusImg.setTo(radius4skin, mask);
+    if (!radiusScale.empty())
+      cv::multiply(radiusImg, radiusScale, radiusImg);
+
+    eps.emplace_back(strengths[k].eps);
+    if (!epsScale.empty()) {
+      epsScale.convertTo(epsImgs[k], CV_32F, strengths[k].eps);
+      eps.back() = EpsMap(epsImgs[k]);
+    }
+  }
+
+  // The luma-only mode converts and recombines the colors around the filter, so its
+  // strengths are filtered one after another
+  if (opts.lumaOnly) {
+    for (size_t k = 0; k < nStrength; ++k)
+      applyLumaADF(guidance, src, dsts[k], radiusImgs[k], eps[k],
+                   opts.radius4skin * strengths[k].radiusScale);
+    return;
+  }
+  filterBatch(src, guidance, dsts, radiusImgs, eps, outputDepth(src));
+}
+
+void GuidedFilter::applyLumaADF(const cv::Mat &guidance, const cv::Mat &src, cv::Mat &dst,
+                                const cv::Mat &radius, const EpsMap &eps,
+                                const float chromaRadius) {
+  CV_Assert(opts.chromaSubsample >= 0);
+  // Y of YCrCb, and the color differences R - Y and B - Y which are Cr and Cb up to a
+  // scale. Working with the differences turns the conversion back into additions.
+  constexpr float wB = 0.114f, wG = 0.587f, wR = 0.299f;
+  src.convertTo(colorImg, CV_32F);
+  cv::transform(colorImg, lumaImg, cv::Matx13f(wB, wG, wR));
+  filterBatch(lumaImg, guidance, {&lumaOutImg, 1}, {&radius, 1}, {&eps, 1}, CV_32F);
+
+  // The chroma is only averaged over the pixels with a positive radius(normalized
+  // convolution), so that of hair, lips or background does not bleed into the skin. It
+  // is evaluated on their bounding box, with a cell of margin for the upsampling.
+  const auto step = opts.chromaSubsample;
+  const auto roi = step > 0 ? activeRegion({&radius, 1}, step, step) : cv::Rect();
+  const auto smoothChroma = !roi.empty();
+  if (smoothChroma) {
+    // R - Y and B - Y weighted by the skin, and the weight itself
+    chromaImg.create(roi.size(), CV_32FC3);
+    cv::parallel_for_(cv::Range(0, roi.height), [&](const cv::Range &rows) {
+      for (int x = rows.start; x < rows.end; ++x) {
+        const auto rRow = radius.ptr<float>(roi.y + x) + roi.x;
+        const auto sRow = colorImg.ptr<float>(roi.y + x) + 3 * roi.x;
+        auto cRow = chromaImg.ptr<float>(x);
+        for (int y = 0; y < roi.width; ++y) {
+          const auto c = sRow + 3 * y;
+          const auto w = rRow[y] > 0 ? 1.f : 0.f;
+          const auto Y = wB * c[0] + wG * c[1] + wR * c[2];
+          cRow[3 * y] = w * (c[2] - Y);
+          cRow[3 * y + 1] = w * (c[0] - Y);
+          cRow[3 * y + 2] = w;
+        }
+      }
+    });
+    const auto sizeDn =
+        cv::Size((roi.width + step - 1) / step, (roi.height + step - 1) / step);
+    cv::resize(chromaImg, chromaDnImg, sizeDn, 0, 0, cv::INTER_AREA);
+    const auto N = 2 * cvRound(chromaRadius / step) + 1;
+    cv::boxFilter(chromaDnImg, chromaDnImg, CV_32F, cv::Size(N, N), cv::Point(-1, -1),
+                  /*normalize=*/true, cv::BORDER_CONSTANT);
+    cv::resize(chromaDnImg, chromaImg, roi.size(), 0, 0, cv::INTER_LINEAR);
+  }
+
+  const auto ddepth = outputDepth(src);
+  CV_Assert(isKernelDepth(ddepth));
+  dst.create(src.size(), CV_MAKETYPE(ddepth, 3));
+  const auto nCol = src.cols;
+  visitDepth(ddepth, [&](auto zero) {
+    using D = decltype(zero);
+    cv::parallel_for_(cv::Range(0, src.rows), [&](const cv::Range &rows) {
+      for (int x = rows.start; x < rows.end; ++x) {
+        const auto rRow = radius.ptr<float>(x);
+        const auto sRow = colorImg.ptr<float>(x);
+        const auto yRow = lumaOutImg.ptr<float>(x);
+        const auto cRow = smoothChroma && x >= roi.y && x < roi.br().y
+                              ? chromaImg.ptr<float>(x - roi.y)
+                              : nullptr;
+        auto dRow = dst.ptr<D>(x);
+        for (int y = 0; y < nCol; ++y) {
+          const auto s = sRow + 3 * y;
+          auto d = dRow + 3 * y;
+          if (rRow[y] == 0) {
+            for (int c = 0; c < 3; ++c)
+              d[c] = cv::saturate_cast<D>(s[c]);
+            continue;
+          }
+          const auto Y = yRow[y];
+          // The averaged chroma and its weight, which is 0 outside of the region
+          const auto c = cRow && y >= roi.x && y < roi.br().x ? cRow + 3 * (y - roi.x)
+                                                              : nullptr;
+          const auto w = c ? c[2] : 0.f;
+          if (w <= 0) {
+            // Unchanged chroma shifts all of the channels by the change of Y
+            const auto dY = Y - (wB * s[0] + wG * s[1] + wR * s[2]);
+            for (int c = 0; c < 3; ++c)
+              d[c] = cv::saturate_cast<D>(s[c] + dY);
+            continue;
+          }
+          const auto dR = c[0] / w, dB = c[1] / w;
+          d[0] = cv::saturate_cast<D>(Y + dB);
+          d[1] = cv::saturate_cast<D>(Y - (wR * dR + wB * dB) / wG);
+          d[2] = cv::saturate_cast<D>(Y + dR);
+        }
+      }
+    });
+  });
 }
@@ -0,0 +1,146 @@
+/// \file RecursiveGaussian.cpp
+/// \brief RecursiveGaussian Implmentation
+///
+
+#include "fabsoften/RecursiveGaussian.h"
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+using namespace fabsoften;
+
+namespace {
+/// Number of columns filtered together, the rows of a stripe stay in L1.
+constexpr int ColumnStripe = 64;
+} // namespace
+
+RecursiveGaussian::RecursiveGaussian(double sigma) {
+  CV_Assert(sigma >= MinSigma);
+
+  // Young & van Vliet, "Recursive implementation of the Gaussian filter", 1995
+  const auto q = sigma >= 2.5 ? 0.98711 * sigma - 0.96330
+                              : 3.97156 - 4.14554 * std::sqrt(1 - 0.26891 * sigma);
+  const auto q2 = q * q, q3 = q2 * q;
+  const auto b0 = 1.57825 + 2.44413 * q + 1.4281 * q2 + 0.422205 * q3;
+  const auto a1 = (2.44413 * q + 2.85619 * q2 + 1.26661 * q3) / b0;
+  const auto a2 = -(1.4281 * q2 + 1.26661 * q3) / b0;
+  const auto a3 = 0.422205 * q3 / b0;
+  a = {a1, a2, a3};
+  b = 1 - (a1 + a2 + a3);
+
+  // Triggs & Sdika, "Boundary conditions for Young-van Vliet recursive filtering", 2006,
+  // scaled by the input gain as both passes are normalized here
+  const auto s = b / ((1 + a1 - a2 + a3) * (1 - a1 - a2 - a3) * (1 + a2 + (a1 - a3) * a3));
+  m[0] = {s * (-a3 * a1 + 1 - a3 * a3 - a2), s * (a3 + a1) * (a2 + a3 * a1),
+          s * a3 * (a1 + a3 * a2)};
+  m[1] = {s * (a1 + a3 * a2), -s * (a2 - 1) * (a2 + a3 * a1),
+          -s * (a3 * a1 + a3 * a3 + a2 - 1) * a3};
+  m[2] = {s * (a3 * a1 + a2 + a1 * a1 - a2 * a2),
+          s * (a1 * a2 + a3 * a2 * a2 - a1 * a3 * a3 - a3 * a3 * a3 - a3 * a2 + a3),
+          s * a3 * (a1 + a3 * a2)};
+}
+
+void RecursiveGaussian::filter(double *line, int n) const {
+  // Causal pass, the samples before the first one are replicated
+  const auto last = line[n - 1];
+  double w1 = line[0], w2 = w1, w3 = w1;
+  for (int i = 0; i < n; ++i) {
+    const auto w = b * line[i] + a[0] * w1 + a[1] * w2 + a[2] * w3;
+    line[i] = w;
+    w3 = w2, w2 = w1, w1 = w;
+  }
+
+  // Anti-causal pass, from its outputs at n - 1, n and n + 1
+  const double d[3] = {w1 - last, w2 - last, w3 - last};
+  double v[3];
+  for (int k = 0; k < 3; ++k)
+    v[k] = last + m[k][0] * d[0] + m[k][1] * d[1] + m[k][2] * d[2];
+  auto y1 = v[0], y2 = v[1], y3 = v[2];
+  line[n - 1] = y1;
+  for (int i = n - 2; i >= 0; --i) {
+    const auto y = b * line[i] + a[0] * y1 + a[1] * y2 + a[2] * y3;
+    line[i] = y;
+    y3 = y2, y2 = y1, y1 = y;
+  }
+}
+
+void RecursiveGaussian::filterColumns(cv::Mat &plane, int begin, int end) const {
+  CV_Assert(plane.type() == CV_32FC1 && 0 <= begin && begin < end && end <= plane.cols);
+
+  // Run the recursion of every column of the stripe side by side, one row at a time
+  const auto nRow = plane.rows;
+  const auto width = end - begin;
+  std::vector<double> state(4 * width);
+  auto s1 = state.data(), s2 = s1 + width, s3 = s2 + width, last = s3 + width;
+  const auto first = plane.ptr<float>(0) + begin;
+  std::copy_n(plane.ptr<float>(nRow - 1) + begin, width, last);
+  std::copy_n(first, width, s1);
+  std::copy_n(first, width, s2);
+  std::copy_n(first, width, s3);
+
+  // Causal pass, s3 is overwritten by the newest row and rotated to the front
+  for (int x = 0; x < nRow; ++x) {
+    auto row = plane.ptr<float>(x) + begin;
+    for (int y = 0; y < width; ++y) {
+      s3[y] = b * row[y] + a[0] * s1[y] + a[1] * s2[y] + a[2] * s3[y];
+      row[y] = static_cast<float>(s3[y]);
+    }
+    std::swap(s2, s3);
+    std::swap(s1, s2);
+  }
+
+  // Anti-causal pass, from its outputs at nRow - 1, nRow and nRow + 1
+  auto lastRow = plane.ptr<float>(nRow - 1) + begin;
+  for (int y = 0; y < width; ++y) {
+    const auto d0 = s1[y] - last[y], d1 = s2[y] - last[y], d2 = s3[y] - last[y];
+    s1[y] = last[y] + m[0][0] * d0 + m[0][1] * d1 + m[0][2] * d2;
+    s2[y] = last[y] + m[1][0] * d0 + m[1][1] * d1 + m[1][2] * d2;
+    s3[y] = last[y] + m[2][0] * d0 + m[2][1] * d1 + m[2][2] * d2;
+    lastRow[y] = static_cast<float>(s1[y]);
+  }
+  for (int x = nRow - 2; x >= 0; --x) {
+    auto row = plane.ptr<float>(x) + begin;
+    for (int y = 0; y < width; ++y) {
+      s3[y] = b * row[y] + a[0] * s1[y] + a[1] * s2[y] + a[2] * s3[y];
+      row[y] = static_cast<float>(s3[y]);
+    }
+    std::swap(s2, s3);
+    std::swap(s1, s2);
+  }
+}
+
+void RecursiveGaussian::blur(const cv::Mat &src, cv::Mat &dst, double sigmaX,
+                             double sigmaY) {
+  CV_Assert(src.type() == CV_8UC1 || src.type() == CV_32FC1);
+  if (std::min(sigmaX, sigmaY) < MinSigma) {
+    cv::GaussianBlur(src, dst, cv::Size(0, 0), sigmaX, sigmaY, cv::BORDER_REPLICATE);
+    return;
+  }
+
+  const RecursiveGaussian rowFilter(sigmaX), columnFilter(sigmaY);
+  const auto nCol = src.cols;
+  cv::Mat plane(src.size(), CV_32FC1);
+  const auto filterRows = [&](auto zero) {
+    using T = decltype(zero);
+    cv::parallel_for_(cv::Range(0, src.rows), [&](const cv::Range &rows) {
+      std::vector<double> line(nCol);
+      for (int x = rows.start; x < rows.end; ++x) {
+        std::copy_n(src.ptr<T>(x), nCol, line.begin());
+        rowFilter.filter(line.data(), nCol);
+        std::copy_n(line.begin(), nCol, plane.ptr<float>(x));
+      }
+    });
+  };
+  if (src.depth() == CV_8U)
+    filterRows(uchar(0));
+  else
+    filterRows(0.f);
+
+  const auto nStripe = (nCol + ColumnStripe - 1) / ColumnStripe;
+  cv::parallel_for_(cv::Range(0, nStripe), [&](const cv::Range &stripes) {
+    for (int i = stripes.start; i < stripes.end; ++i)
+      columnFilter.filterColumns(plane, i * ColumnStripe,
+                                 std::min(nCol, (i + 1) * ColumnStripe));
+  });
+  plane.convertTo(dst, src.depth());
+}
@@ -33,8 +33,8 @@ void SkinMaskGenerator::generateEllipseFaceMask(Face &face, cv::Size size) {
   cv::ellipse(maskCur, box, cv::Scalar(255), /*thickness=*/-1, cv::FILLED);
 }
 
-void SkinMaskGenerator::generateBinaryMask(Face &face, cv::Mat dstMask) {
-  generateEllipseFaceMask(face, dstMask.size());
+void SkinMaskGenerator::drawRegions(Face &face, cv::Size size) {
+  generateEllipseFaceMask(face, size);
 
   // TODO: make sure those curves are available in `face`
   const auto &curves = face.getCurves();
@@ -45,8 +45,8 @@ void SkinMaskGenerator::generateBinaryMask(Face &face, cv::Mat dstMask) {
   }
 
   if (opts.EnableEyeBrow) {
-    const auto offset = dstMask.cols * opts.BrowOffsetRate;
-    const auto thickness = dstMask.rows * opts.BrowThicknessRate;
+    const auto offset = size.width * opts.BrowOffsetRate;
+    const auto thickness = size.height * opts.BrowThicknessRate;
 
     std::vector<cv::Point> pts;
     for (auto &pt : (*curves)["leftEyeBrow"])
@@ -69,6 +69,10 @@ void SkinMaskGenerator::generateBinaryMask(Face &face, cv::Mat dstMask) {
     cv::fillConvexPoly(maskCur, (*curves)["leftCheek"], cv::Scalar(255), cv::LINE_AA);
     cv::fillConvexPoly(maskCur, (*curves)["rightCheek"], cv::Scalar(255), cv::LINE_AA);
   }
+}
+
+void SkinMaskGenerator::generateBinaryMask(Face &face, cv::Mat dstMask) {
+  drawRegions(face, dstMask.size());
 
   const auto N = opts.ErodingSize;
   cv::Mat element = cv::getStructuringElement(cv::MORPH_ELLIPSE, cv::Size(N, N));
@@ -76,3 +80,56 @@ void SkinMaskGenerator::generateBinaryMask(Face &face, cv::Mat dstMask) {
 
   copyCurrentMaskTo(dstMask);
 }
+
+void SkinMaskGenerator::generateSoftMask(Face &face, const cv::Mat &guidance,
+                                         cv::Mat dstMask) {
+  CV_Assert(guidance.type() == CV_8UC3 && guidance.size() == dstMask.size());
+  CV_Assert(opts.featherScale >= 1);
+  const auto size = dstMask.size();
+  drawRegions(face, size);
+
+  // Erode on the coarse grid, the element shrinks with the grid
+  const auto s = static_cast<int>(opts.featherScale);
+  const auto gridSize = cv::Size((size.width + s - 1) / s, (size.height + s - 1) / s);
+  cv::resize(maskCur, maskDn, gridSize, 0, 0, cv::INTER_AREA);
+  const auto N = std::max(static_cast<int>(opts.ErodingSize) / s, 1) | 1;
+  cv::Mat element = cv::getStructuringElement(cv::MORPH_ELLIPSE, cv::Size(N, N));
+  cv::morphologyEx(maskDn, maskDn, cv::MORPH_ERODE, element);
+  maskDn.convertTo(maskDn, CV_32F, 1.0 / 255);
+
+  cv::cvtColor(guidance, guideImg, cv::COLOR_BGR2GRAY);
+  guideImg.convertTo(guideImg, CV_32F, 1.0 / 255);
+  cv::resize(guideImg, guideDn, gridSize, 0, 0, cv::INTER_AREA);
+
+  // Guided filter on the coarse grid: alpha = a * I + b in every window
+  const auto r = std::max(
+      cvRound(std::min(gridSize.width, gridSize.height) * opts.featherRadiusRate), 1);
+  const auto window = cv::Size(2 * r + 1, 2 * r + 1);
+  cv::boxFilter(guideDn, meanI, CV_32F, window);
+  cv::boxFilter(maskDn, meanP, CV_32F, window);
+  cv::multiply(guideDn, maskDn, workImg);
+  cv::boxFilter(workImg, covIP, CV_32F, window);
+  cv::multiply(meanI, meanP, workImg);
+  cv::subtract(covIP, workImg, covIP);
+  cv::multiply(guideDn, guideDn, workImg);
+  cv::boxFilter(workImg, varI, CV_32F, window);
+  cv::multiply(meanI, meanI, workImg);
+  cv::subtract(varI, workImg, varI);
+
+  // a = cov(I, p) / (var(I) + eps), b = mean(p) - a * mean(I)
+  varI += opts.featherEps;
+  cv::divide(covIP, varI, covIP);
+  cv::multiply(covIP, meanI, workImg);
+  cv::subtract(meanP, workImg, meanP);
+  cv::boxFilter(covIP, covIP, CV_32F, window);
+  cv::boxFilter(meanP, meanP, CV_32F, window);
+
+  // Apply the upsampled coefficients to the full-resolution guidance
+  cv::resize(covIP, workImg, size, 0, 0, cv::INTER_LINEAR);
+  cv::multiply(workImg, guideImg, guideImg);
+  cv::resize(meanP, workImg, size, 0, 0, cv::INTER_LINEAR);
+  cv::add(guideImg, workImg, guideImg);
+  guideImg.convertTo(maskCur, CV_8U, 255);
+
+  copyCurrentMaskTo(dstMask);
+}
@@ -0,0 +1,63 @@
+/// \file TextureRestorer.cpp
+/// \brief TextureRestorer Implmentation
+///
+
+#include "fabsoften/TextureRestorer.h"
+
+using namespace fabsoften;
+
+void TextureRestorer::extractDetail(const cv::Mat &src) {
+  CV_Assert(src.type() == CV_8UC3 && opts.levels >= 1);
+
+  // Collapse the Laplacian pyramid without its finest bands, what is left is the detail
+  std::vector<cv::Size> pyramidSizes{src.size()};
+  for (int level = 0; level < opts.levels; ++level) {
+    const auto &size = pyramidSizes.back();
+    pyramidSizes.emplace_back((size.width + 1) / 2, (size.height + 1) / 2);
+  }
+  cv::pyrDown(src, baseImg, pyramidSizes[1]);
+  for (size_t i = 2; i < pyramidSizes.size(); ++i)
+    cv::pyrDown(baseImg, baseImg, pyramidSizes[i]);
+  for (auto i = pyramidSizes.size() - 1; i-- > 0;)
+    cv::pyrUp(baseImg, baseImg, pyramidSizes[i]);
+
+  cv::subtract(src, baseImg, detailImg, cv::noArray(), CV_16S);
+}
+
+void TextureRestorer::restore(const cv::Mat &mask, const cv::Mat &smoothed, cv::Mat &dst) {
+  CV_Assert(!detailImg.empty() && smoothed.size() == detailImg.size() &&
+            smoothed.channels() == 3);
+  CV_Assert(mask.empty() || (mask.type() == CV_8UC1 && mask.size() == detailImg.size()));
+
+  // 8-bit and float images are read as is, `dst` may alias an 8-bit `smoothed`
+  auto smoothedIn = smoothed;
+  if (smoothed.depth() != CV_8U && smoothed.depth() != CV_32F) {
+    smoothed.convertTo(smoothedImg, CV_32F);
+    smoothedIn = smoothedImg;
+  }
+
+  dst.create(detailImg.size(), CV_8UC3);
+  const auto gain = opts.strength / 255.0f;
+  const auto nCol = detailImg.cols;
+  const auto restoreRows = [&](auto zero) {
+    using S = decltype(zero);
+    cv::parallel_for_(cv::Range(0, detailImg.rows), [&](const cv::Range &rows) {
+      for (int x = rows.start; x < rows.end; ++x) {
+        const auto mRow = mask.empty() ? nullptr : mask.ptr<uchar>(x);
+        const auto sRow = smoothedIn.ptr<S>(x);
+        const auto tRow = detailImg.ptr<short>(x);
+        auto dRow = dst.ptr<uchar>(x);
+        for (int y = 0; y < nCol; ++y) {
+          const auto w = gain * (mRow ? mRow[y] : 255);
+          for (int c = 0; c < 3; ++c)
+            dRow[3 * y + c] =
+                cv::saturate_cast<uchar>(sRow[3 * y + c] + w * tRow[3 * y + c]);
+        }
+      }
+    });
+  };
+  if (smoothedIn.depth() == CV_8U)
+    restoreRows(uchar(0));
+  else
+    restoreRows(0.f);
+}
@@ -1,6 +1,26 @@
 #include "ADF.h"
 #include <catch2/catch_test_macros.hpp>
+#include <filesystem>
+#include <opencv2/imgcodecs.hpp>
 #include <opencv2/imgproc.hpp>
+#include <set>
+
+namespace {
+/// Random color image blurred to the scale of skin, shared by the guided filter tests.
+cv::Mat smoothImage() {
+  cv::Mat img(96, 128, CV_8UC3);
+  cv::randu(img, cv::Scalar(0, 0, 0), cv::Scalar(255, 255, 255));
+  cv::GaussianBlur(img, img, cv::Size(0, 0), /*sigma=*/4);
+  return img;
+}
+
+/// Mask of a rectangle of skin, with a border of 16 pixels around it.
+cv::Mat skinMask(cv::Size size) {
+  cv::Mat mask = cv::Mat::zeros(size, CV_8UC1);
+  mask(cv::Rect(16, 16, size.width - 32, size.height - 32)).setTo(255);
+  return mask;
+}
+} // namespace
 
 TEST_CASE("ADF", "[integral image]") {
   cv::Mat img(100, 100, CV_8UC3);
@@ -63,3 +83,835 @@ TEST_CASE("ADF", "[integral image]") {
         REQUIRE(boxImg.at<cv::Vec3b>(x, y) == meanImg.at<cv::Vec3b>(x, y));
   }
 }
+
+TEST_CASE("Dynamic Mean Filter", "[running sum]") {
+  cv::Mat img(64, 80, CV_32FC1);
+  cv::randu(img, cv::Scalar(0), cv::Scalar(255));
+
+  fabsoften::GuidedFilter gf;
+  cv::Mat meanImg;
+
+  SECTION("uniform radius") {
+    constexpr auto r = 4; // radius
+    const cv::Mat radius(img.size(), CV_32FC1, cv::Scalar(r));
+    gf.dynamicMeanFilter(img, meanImg, radius);
+
+    // Windows clipped by the border are normalized by their clipped area
+    const auto blockSize = cv::Size(2 * r + 1, 2 * r + 1);
+    const cv::Mat ones(img.size(), CV_32FC1, cv::Scalar(1));
+    cv::Mat boxImg, areaImg;
+    cv::boxFilter(img, boxImg, /*ddepth=*/-1, blockSize, cv::Point(-1, -1),
+                  /*normalize=*/false, cv::BORDER_CONSTANT);
+    cv::boxFilter(ones, areaImg, /*ddepth=*/-1, blockSize, cv::Point(-1, -1),
+                  /*normalize=*/false, cv::BORDER_CONSTANT);
+    cv::divide(boxImg, areaImg, boxImg);
+    REQUIRE(cv::norm(meanImg, boxImg, cv::NORM_INF) < 1e-3);
+  }
+
+  SECTION("mixed radii") {
+    cv::Mat radius = cv::Mat::zeros(img.size(), CV_32FC1);
+    radius(cv::Rect(10, 8, 50, 40)).setTo(3);
+    radius(cv::Rect(30, 20, 20, 10)).setTo(2.5);
+    radius(cv::Rect(0, 50, 80, 14)).setTo(5);
+    gf.dynamicMeanFilter(img, meanImg, radius);
+
+    cv::Mat integralImg;
+    cv::integral(img, integralImg, CV_64F);
+    const auto nRow = integralImg.rows, nCol = integralImg.cols;
+    for (int x = 0; x < img.rows; ++x)
+      for (int y = 0; y < img.cols; ++y) {
+        const auto r = radius.at<float>(x, y);
+        const auto xA = std::max<int>(x - r, 0);
+        const auto yA = std::max<int>(y - r, 0);
+        const auto xD = std::min<int>(x + r + 1, nRow - 1);
+        const auto yD = std::min<int>(y + r + 1, nCol - 1);
+        const auto sum = integralImg.at<double>(xD, yD) + integralImg.at<double>(xA, yA) -
+                         integralImg.at<double>(xA, yD) - integralImg.at<double>(xD, yA);
+        const auto expected = sum / ((xD - xA) * (yD - yA));
+        REQUIRE(std::abs(meanImg.at<float>(x, y) - expected) < 1e-3);
+      }
+  }
+  SECTION("idle running sums") {
+    // Bands of rows alternate between two radii, so each running sum sits idle for a few
+    // rows and either catches up or is summed afresh
+    cv::Mat radius(img.size(), CV_32FC1);
+    for (int x = 0; x < img.rows; ++x)
+      radius.row(x).setTo(x / 2 % 2 == 0 ? 2 : 4);
+    gf.dynamicMeanFilter(img, meanImg, radius);
+
+    cv::Mat integralImg;
+    cv::integral(img, integralImg, CV_64F);
+    for (int x = 0; x < img.rows; ++x)
+      for (int y = 0; y < img.cols; ++y) {
+        const auto r = static_cast<int>(radius.at<float>(x, y));
+        const auto xA = std::max(x - r, 0), yA = std::max(y - r, 0);
+        const auto xD = std::min(x + r + 1, img.rows), yD = std::min(y + r + 1, img.cols);
+        const auto sum = integralImg.at<double>(xD, yD) + integralImg.at<double>(xA, yA) -
+                         integralImg.at<double>(xA, yD) - integralImg.at<double>(xD, yA);
+        const auto expected = sum / ((xD - xA) * (yD - yA));
+        REQUIRE(std::abs(meanImg.at<float>(x, y) - expected) < 1e-3);
+      }
+  }
+
+  SECTION("integral fallback") {
+    // More distinct radii than running sums, the windows of the integral image lookups are
+    // normalized by their clipped area as well
+    cv::Mat radius(img.size(), CV_32FC1);
+    for (int x = 0; x < img.rows; ++x)
+      for (int y = 0; y < img.cols; ++y)
+        radius.at<float>(x, y) = static_cast<float>((x / 8 + y / 10) % 12) / 2;
+    gf.dynamicMeanFilter(img, meanImg, radius);
+
+    cv::Mat integralImg;
+    cv::integral(img, integralImg, CV_64F);
+    for (int x = 0; x < img.rows; ++x)
+      for (int y = 0; y < img.cols; ++y) {
+        const auto r = radius.at<float>(x, y);
+        const auto xA = std::max(x - cvCeil(r), 0);
+        const auto yA = std::max(y - cvCeil(r), 0);
+        const auto xD = std::min(x + cvFloor(r) + 1, img.rows);
+        const auto yD = std::min(y + cvFloor(r) + 1, img.cols);
+        const auto sum = integralImg.at<double>(xD, yD) + integralImg.at<double>(xA, yA) -
+                         integralImg.at<double>(xA, yD) - integralImg.at<double>(xD, yA);
+        const auto expected = sum / ((xD - xA) * (yD - yA));
+        REQUIRE(std::abs(meanImg.at<float>(x, y) - expected) < 1e-3);
+      }
+  }
+
+  SECTION("8-bit input") {
+    // More distinct radii than running sums, the rest is served by integer integral images
+    cv::Mat img8U, radius(img.size(), CV_32FC1);
+    img.convertTo(img8U, CV_8U);
+    for (int x = 0; x < img.rows; ++x)
+      for (int y = 0; y < img.cols; ++y)
+        radius.at<float>(x, y) = static_cast<float>((x / 8 + y / 10) % 12) / 2;
+    gf.dynamicMeanFilter(img8U, meanImg, radius);
+
+    cv::Mat imgF, expected;
+    img8U.convertTo(imgF, CV_32F);
+    gf.dynamicMeanFilter(imgF, expected, radius);
+    REQUIRE(cv::norm(meanImg, expected, cv::NORM_INF) == 0);
+  }
+}
+
+TEST_CASE("Dynamic Guided Filter", "[guided filter]") {
+  cv::Mat src(48, 64, CV_8UC1), guidance(48, 64, CV_8UC3);
+  cv::randu(src, cv::Scalar(0), cv::Scalar(255));
+  cv::randu(guidance, cv::Scalar(0, 0, 0), cv::Scalar(255, 255, 255));
+
+  fabsoften::GuidedFilter gf;
+  cv::Mat dst;
+
+  SECTION("zero radius") {
+    const cv::Mat radius = cv::Mat::zeros(src.size(), CV_32FC1);
+    gf.dynamicGuidedFilter(src, guidance, dst, radius, /*eps=*/300);
+    cv::Mat srcF;
+    src.convertTo(srcF, CV_32F);
+    REQUIRE(cv::norm(dst, srcF, cv::NORM_INF) < 1e-3);
+  }
+
+  SECTION("flat input") {
+    const cv::Mat flat(src.size(), CV_8UC1, cv::Scalar(128));
+    cv::Mat radius(src.size(), CV_32FC1, cv::Scalar(5));
+    radius(cv::Rect(0, 0, 20, 20)).setTo(2.5);
+    gf.dynamicGuidedFilter(flat, guidance, dst, radius, /*eps=*/300);
+    // Every window is flat, including the ones clipped by the border
+    const cv::Mat expected(src.size(), CV_32FC1, cv::Scalar(128));
+    REQUIRE(cv::norm(dst, expected, cv::NORM_INF) < 1e-2);
+  }
+
+  SECTION("singular covariance") {
+    // A flat guidance with eps = 0 makes every Sigma singular, which degrades to a = 0 and
+    // therefore a plain mean filter of the input
+    const cv::Mat flat(src.size(), CV_8UC3, cv::Scalar(64, 128, 192));
+    const cv::Mat radius(src.size(), CV_32FC1, cv::Scalar(3));
+    gf.dynamicGuidedFilter(src, flat, dst, radius, /*eps=*/0);
+    cv::Mat srcF, meanP, expected;
+    src.convertTo(srcF, CV_32F);
+    gf.dynamicMeanFilter(srcF, meanP, radius);
+    gf.dynamicMeanFilter(meanP, expected, radius);
+    REQUIRE(cv::norm(dst, expected, cv::NORM_INF) < 1e-2);
+  }
+
+  SECTION("sparse radius") {
+    // Only a patch is filtered; with a flat guidance and eps = 0 the result must still
+    // match the full-frame double mean filter
+    const cv::Mat flat(src.size(), CV_8UC3, cv::Scalar(64, 128, 192));
+    cv::Mat radius = cv::Mat::zeros(src.size(), CV_32FC1);
+    radius(cv::Rect(30, 20, 8, 6)).setTo(3);
+    gf.dynamicGuidedFilter(src, flat, dst, radius, /*eps=*/0);
+    cv::Mat srcF, meanP, expected;
+    src.convertTo(srcF, CV_32F);
+    gf.dynamicMeanFilter(srcF, meanP, radius);
+    gf.dynamicMeanFilter(meanP, expected, radius);
+    REQUIRE(cv::norm(dst, expected, cv::NORM_INF) < 1e-2);
+  }
+
+  SECTION("thread count") {
+    // Row stripes prime their own running sums, which must not change the result
+    cv::Mat radius(src.size(), CV_32FC1, cv::Scalar(2));
+    radius(cv::Rect(0, 0, 20, 20)).setTo(2.5);
+    cv::setNumThreads(1);
+    gf.dynamicGuidedFilter(src, guidance, dst, radius, /*eps=*/300);
+    cv::setNumThreads(-1);
+    cv::Mat expected;
+    gf.dynamicGuidedFilter(src, guidance, expected, radius, /*eps=*/300);
+    REQUIRE(cv::norm(dst, expected, cv::NORM_INF) < 1e-3);
+  }
+
+  SECTION("tiles") {
+    cv::Mat radius(src.size(), CV_32FC1, cv::Scalar(3));
+    radius(cv::Rect(0, 0, 20, 20)).setTo(2.5);
+    radius(cv::Rect(30, 10, 10, 10)).setTo(0);
+    gf.dynamicGuidedFilter(src, guidance, dst, radius, /*eps=*/300);
+
+    fabsoften::GFOptions opts;
+    opts.tileSize = 16;
+    fabsoften::GuidedFilter tiled(opts);
+    cv::Mat expected;
+    tiled.dynamicGuidedFilter(src, guidance, expected, radius, /*eps=*/300);
+    REQUIRE(cv::norm(dst, expected, cv::NORM_INF) == 0);
+
+    // Tiles derived from a budget keep the planes of a tile and its halo within it
+    opts.tileSize = 0;
+    opts.tileBudget = 256 << 10;
+    fabsoften::GuidedFilter budgeted(opts);
+    const std::set<std::string> tilePlanes{"statistics", "statistics SAT", "coefficients",
+                                           "coefficient SAT"};
+    for (const auto needsIntegral : {false, true}) {
+      const auto plan = budgeted.planBuffers(src.size(), src.channels(), /*maxRadius=*/3,
+                                             needsIntegral);
+      const auto whole = gf.planBuffers(src.size(), src.channels(), /*maxRadius=*/3,
+                                        needsIntegral);
+      size_t tileBytes = 0, wholeBytes = 0;
+      for (size_t i = 0; i < plan.planes.size(); ++i)
+        if (tilePlanes.contains(plan.planes[i].name)) {
+          tileBytes += plan.planes[i].bytes;
+          wholeBytes += whole.planes[i].bytes;
+        }
+      REQUIRE(tileBytes <= opts.tileBudget);
+      REQUIRE(tileBytes < wholeBytes);
+    }
+    budgeted.dynamicGuidedFilter(src, guidance, expected, radius, /*eps=*/300);
+    REQUIRE(cv::norm(dst, expected, cv::NORM_INF) == 0);
+  }
+
+  SECTION("gray guidance") {
+    cv::Mat gray;
+    cv::cvtColor(guidance, gray, cv::COLOR_BGR2GRAY);
+    const cv::Mat radius(src.size(), CV_32FC1, cv::Scalar(3));
+    gf.dynamicGuidedFilter(src, gray, dst, radius, /*eps=*/300);
+
+    // Reference: the textbook gray guided filter, which agrees away from the border
+    cv::Mat I, p, meanI, meanP, corrII, corrIp;
+    gray.convertTo(I, CV_32F);
+    src.convertTo(p, CV_32F);
+    const auto window = cv::Size(7, 7);
+    cv::boxFilter(I, meanI, CV_32F, window);
+    cv::boxFilter(p, meanP, CV_32F, window);
+    cv::boxFilter(I.mul(I), corrII, CV_32F, window);
+    cv::boxFilter(I.mul(p), corrIp, CV_32F, window);
+    cv::Mat varI = corrII - meanI.mul(meanI), covIp = corrIp - meanI.mul(meanP);
+    cv::Mat a, b, meanA, meanB;
+    cv::divide(covIp, varI + 300, a);
+    b = meanP - a.mul(meanI);
+    cv::boxFilter(a, meanA, CV_32F, window);
+    cv::boxFilter(b, meanB, CV_32F, window);
+    const cv::Mat expected = meanA.mul(I) + meanB;
+    const auto interior = cv::Rect(6, 6, src.cols - 12, src.rows - 12);
+    REQUIRE(cv::norm(dst(interior), expected(interior), cv::NORM_INF) < 1e-2);
+
+    // Converting the color guidance gives the same result
+    fabsoften::GFOptions opts;
+    opts.grayGuidance = true;
+    opts.tileSize = 16;
+    fabsoften::GuidedFilter grayGF(opts);
+    cv::Mat converted;
+    grayGF.dynamicGuidedFilter(src, guidance, converted, radius, /*eps=*/300);
+    REQUIRE(cv::norm(dst, converted, cv::NORM_INF) == 0);
+  }
+
+  SECTION("input and output depths") {
+    cv::Mat radius(src.size(), CV_32FC1, cv::Scalar(3));
+    radius(cv::Rect(30, 10, 10, 10)).setTo(0);
+    cv::Mat srcF, guidanceF, expected;
+    src.convertTo(srcF, CV_32F);
+    guidance.convertTo(guidanceF, CV_32F);
+    gf.dynamicGuidedFilter(srcF, guidanceF, expected, radius, /*eps=*/300);
+
+    // 16-bit images are read in place, mixed depths are converted to float
+    cv::Mat src16, guidance16;
+    src.convertTo(src16, CV_16U);
+    guidance.convertTo(guidance16, CV_16U);
+    gf.dynamicGuidedFilter(src16, guidance16, dst, radius, /*eps=*/300);
+    REQUIRE(cv::norm(dst, expected, cv::NORM_INF) == 0);
+    gf.dynamicGuidedFilter(src, guidanceF, dst, radius, /*eps=*/300);
+    REQUIRE(cv::norm(dst, expected, cv::NORM_INF) == 0);
+
+    // Integer outputs are the rounded float output
+    fabsoften::GFOptions opts;
+    opts.outputDepth = -1;
+    fabsoften::GuidedFilter(opts).dynamicGuidedFilter(src16, guidance16, dst, radius,
+                                                      /*eps=*/300);
+    REQUIRE(dst.type() == CV_16UC1);
+    cv::Mat expected16;
+    expected.convertTo(expected16, CV_16U);
+    REQUIRE(cv::norm(dst, expected16, cv::NORM_INF) == 0);
+
+    // Across the full 16-bit range: scaling the input scales the output, offsetting the
+    // guidance leaves it as is. The variance of the guidance is small next to its mean, so
+    // it has to be computed from unrounded products.
+    src.convertTo(src16, CV_16U, 257);
+    guidance.convertTo(guidance16, CV_16U, 1, 60000);
+    gf.dynamicGuidedFilter(src16, guidance16, dst, radius, /*eps=*/300);
+    REQUIRE(cv::norm(dst, expected * 257, cv::NORM_INF) < 0.5);
+  }
+
+  SECTION("half precision of wide inputs") {
+    // The products of 16-bit or float values would overflow to inf
+    cv::Mat radius(src.size(), CV_32FC1, cv::Scalar(3));
+    cv::Mat src16, guidance16, srcF;
+    src.convertTo(src16, CV_16U, 257);
+    guidance.convertTo(guidance16, CV_16U, 257);
+    src.convertTo(srcF, CV_32F, 257);
+    fabsoften::GFOptions opts;
+    opts.storageDepth = CV_16F;
+    fabsoften::GuidedFilter gf16(opts);
+    REQUIRE_THROWS_AS(
+        gf16.dynamicGuidedFilter(src16, guidance16, dst, radius, /*eps=*/300),
+        cv::Exception);
+    REQUIRE_THROWS_AS(gf16.dynamicGuidedFilter(srcF, guidance, dst, radius, /*eps=*/300),
+                      cv::Exception);
+
+    // Float values within the range of 8-bit ones are accepted
+    src.convertTo(srcF, CV_32F);
+    gf16.dynamicGuidedFilter(srcF, guidance, dst, radius, /*eps=*/300);
+    cv::Mat expected;
+    gf.dynamicGuidedFilter(srcF, guidance, expected, radius, /*eps=*/300);
+    REQUIRE(cv::PSNR(dst, expected) > 60);
+  }
+
+  SECTION("8-bit output") {
+    cv::Mat radius(src.size(), CV_32FC1, cv::Scalar(3));
+    radius(cv::Rect(0, 0, 20, 20)).setTo(2.5);
+    radius(cv::Rect(30, 10, 10, 10)).setTo(0);
+    gf.dynamicGuidedFilter(src, guidance, dst, radius, /*eps=*/300);
+    cv::Mat expected;
+    dst.convertTo(expected, CV_8U);
+
+    // 8-bit outputs are filtered in fixed point, which only rounds pixels close to a half
+    // differently
+    fabsoften::GFOptions opts;
+    opts.outputDepth = CV_8U;
+    fabsoften::GuidedFilter gf8(opts);
+    gf8.dynamicGuidedFilter(src, guidance, dst, radius, /*eps=*/300);
+    REQUIRE(dst.type() == CV_8UC1);
+    REQUIRE(cv::norm(dst, expected, cv::NORM_INF) <= 1);
+    REQUIRE(cv::countNonZero(dst != expected) < dst.total() / 20);
+
+    // Its window sums are exact, so tiles give the same result
+    opts.tileSize = 16;
+    cv::Mat tiled;
+    fabsoften::GuidedFilter(opts).dynamicGuidedFilter(src, guidance, tiled, radius,
+                                                      /*eps=*/300);
+    REQUIRE(cv::norm(dst, tiled, cv::NORM_INF) == 0);
+
+    // Gray guidance, and more radii than running sums with a per-pixel eps
+    for (int y = 0; y < radius.cols; ++y)
+      radius.col(y).setTo(1 + y / 4 * 0.5);
+    cv::Mat epsMap(src.size(), CV_32FC1);
+    cv::randu(epsMap, cv::Scalar(30), cv::Scalar(3000));
+    for (const auto grayGuidance : {false, true}) {
+      opts = fabsoften::GFOptions();
+      opts.grayGuidance = grayGuidance;
+      fabsoften::GuidedFilter(opts).dynamicGuidedFilter(src, guidance, dst, radius,
+                                                        fabsoften::EpsMap(epsMap));
+      dst.convertTo(expected, CV_8U);
+      opts.outputDepth = CV_8U;
+      fabsoften::GuidedFilter(opts).dynamicGuidedFilter(src, guidance, dst, radius,
+                                                        fabsoften::EpsMap(epsMap));
+      REQUIRE(cv::norm(dst, expected, cv::NORM_INF) <= 1);
+      REQUIRE(cv::countNonZero(dst != expected) < dst.total() / 20);
+    }
+  }
+
+  SECTION("cached statistics") {
+    cv::Mat radius(src.size(), CV_32FC1, cv::Scalar(3));
+    radius(cv::Rect(0, 0, 20, 20)).setTo(2.5);
+    cv::Mat changed = src.clone(), expected;
+    changed.at<uchar>(24, 32) ^= 1;
+    for (const auto subsample : {1, 2}) {
+      fabsoften::GFOptions opts;
+      opts.subsample = subsample;
+      fabsoften::GuidedFilter uncached(opts);
+      opts.cacheStatistics = true;
+      fabsoften::GuidedFilter cached(opts);
+      // Only the first call computes the statistics, the others change eps
+      for (const auto eps : {300.0, 30.0, 3000.0}) {
+        cached.dynamicGuidedFilter(src, guidance, dst, radius, eps);
+        uncached.dynamicGuidedFilter(src, guidance, expected, radius, eps);
+        REQUIRE(cv::norm(dst, expected, cv::NORM_INF) == 0);
+      }
+      // A changed input is not served from the cache
+      cached.dynamicGuidedFilter(changed, guidance, dst, radius, /*eps=*/300);
+      uncached.dynamicGuidedFilter(changed, guidance, expected, radius, /*eps=*/300);
+      REQUIRE(cv::norm(dst, expected, cv::NORM_INF) == 0);
+    }
+  }
+
+  SECTION("buffer plan") {
+    const auto plan = gf.planBuffers(src.size(), src.channels(), /*maxRadius=*/3, true);
+    size_t totalBytes = 0;
+    for (const auto &plane : plan.planes)
+      totalBytes += plane.bytes;
+    REQUIRE(plan.liveBytes() <= plan.plannedBytes());
+    REQUIRE(plan.plannedBytes() < totalBytes);
+    // Planes that share a buffer must never be live at the same time
+    for (const auto &a : plan.planes)
+      for (const auto &b : plan.planes)
+        if (&a != &b && a.bytes > 0 && b.bytes > 0 && a.buffer == b.buffer)
+          REQUIRE((a.last < b.first || b.last < a.first));
+
+    // The buffers are kept between calls, so a second call allocates nothing
+    const cv::Mat radius(src.size(), CV_32FC1, cv::Scalar(3));
+    gf.dynamicGuidedFilter(src, guidance, dst, radius, /*eps=*/300);
+    const auto report = gf.memoryReport(src.size(), src.channels(), /*maxRadius=*/3);
+    REQUIRE(report.liveBytes <= report.plannedBytes);
+    REQUIRE(report.actualSize == src.size());
+    gf.dynamicGuidedFilter(src, guidance, dst, radius, /*eps=*/300);
+    REQUIRE(gf.allocatedBytes() == report.actualBytes);
+
+    // The footprint of the last call is not reported for another size
+    const auto otherSize = cv::Size(src.cols * 2, src.rows * 2);
+    const auto planOnly = gf.memoryReport(otherSize, src.channels(), /*maxRadius=*/3);
+    REQUIRE(planOnly.plannedBytes > report.plannedBytes);
+    REQUIRE(planOnly.actualBytes == 0);
+    REQUIRE(planOnly.actualSize.empty());
+
+    // A larger call after a smaller one matches a fresh filter
+    cv::Mat largeSrc, largeGuidance;
+    cv::resize(src, largeSrc, {}, 2, 2);
+    cv::resize(guidance, largeGuidance, {}, 2, 2);
+    cv::Mat largeRadius(largeSrc.size(), CV_32FC1, cv::Scalar(9));
+    largeRadius(cv::Rect(0, 0, 40, 30)).setTo(4.5);
+    for (const auto subsample : {1, 2}) {
+      fabsoften::GFOptions opts;
+      opts.subsample = subsample;
+      fabsoften::GuidedFilter reused(opts), fresh(opts);
+      cv::Mat expected;
+      reused.dynamicGuidedFilter(src, guidance, dst, radius, /*eps=*/300);
+      reused.dynamicGuidedFilter(largeSrc, largeGuidance, dst, largeRadius, /*eps=*/300);
+      fresh.dynamicGuidedFilter(largeSrc, largeGuidance, expected, largeRadius,
+                                /*eps=*/300);
+      REQUIRE(cv::norm(dst, expected, cv::NORM_INF) == 0);
+    }
+
+    // The buffers follow the size of the last call
+    gf.dynamicGuidedFilter(largeSrc, largeGuidance, dst, largeRadius, /*eps=*/300);
+    const auto largeReport =
+        gf.memoryReport(largeSrc.size(), src.channels(), /*maxRadius=*/9, true);
+    REQUIRE(largeReport.actualSize == largeSrc.size());
+    REQUIRE(largeReport.actualBytes > report.actualBytes);
+    fabsoften::GuidedFilter fresh;
+    gf.dynamicGuidedFilter(src, guidance, dst, radius, /*eps=*/300);
+    fresh.dynamicGuidedFilter(src, guidance, dst, radius, /*eps=*/300);
+    REQUIRE(gf.allocatedBytes() == fresh.allocatedBytes());
+  }
+
+  SECTION("shared guidance statistics") {
+    cv::Mat color(src.size(), CV_8UC3);
+    cv::randu(color, cv::Scalar(0, 0, 0), cv::Scalar(255, 255, 255));
+    const cv::Mat radius(src.size(), CV_32FC1, cv::Scalar(3));
+    gf.dynamicGuidedFilter(color, guidance, dst, radius, /*eps=*/300);
+
+    std::array<cv::Mat, 3> channels;
+    cv::split(color, channels);
+    std::array<cv::Mat, 3> dstChannels;
+    cv::split(dst, dstChannels);
+    for (int c = 0; c < 3; ++c) {
+      cv::Mat expected;
+      gf.dynamicGuidedFilter(channels[c], guidance, expected, radius, /*eps=*/300);
+      REQUIRE(cv::norm(dstChannels[c], expected, cv::NORM_INF) < 1e-3);
+    }
+  }
+
+  SECTION("eps map") {
+    const cv::Mat radius(src.size(), CV_32FC1, cv::Scalar(3));
+    gf.dynamicGuidedFilter(src, guidance, dst, radius, /*eps=*/300);
+
+    cv::Mat expected;
+    const cv::Mat uniform(src.size(), CV_32FC1, cv::Scalar(300));
+    gf.dynamicGuidedFilter(src, guidance, expected, radius, fabsoften::EpsMap(uniform));
+    REQUIRE(cv::norm(dst, expected, cv::NORM_INF) == 0);
+
+    // Left half eps 30, right half eps 3000, as floats and as indices into a table
+    cv::Mat epsImg(src.size(), CV_32FC1, cv::Scalar(30));
+    epsImg.colRange(32, 64).setTo(3000);
+    cv::Mat indices = cv::Mat::zeros(src.size(), CV_8UC1);
+    indices.colRange(32, 64).setTo(1);
+    gf.dynamicGuidedFilter(src, guidance, dst, radius, fabsoften::EpsMap(epsImg));
+    gf.dynamicGuidedFilter(src, guidance, expected, radius,
+                           fabsoften::EpsMap(indices, {30, 3000}));
+    REQUIRE(cv::norm(dst, expected, cv::NORM_INF) == 0);
+
+    // Away from the seam each half matches the filter with a uniform eps
+    cv::Mat left, right;
+    gf.dynamicGuidedFilter(src, guidance, left, radius, /*eps=*/30);
+    gf.dynamicGuidedFilter(src, guidance, right, radius, /*eps=*/3000);
+    REQUIRE(cv::norm(dst.colRange(0, 24), left.colRange(0, 24), cv::NORM_INF) == 0);
+    REQUIRE(cv::norm(dst.colRange(40, 64), right.colRange(40, 64), cv::NORM_INF) == 0);
+    REQUIRE(cv::norm(left, right, cv::NORM_INF) > 1);
+  }
+
+  SECTION("streaming") {
+    cv::Mat radius(src.size(), CV_32FC1, cv::Scalar(3));
+    radius(cv::Rect(0, 0, 20, 20)).setTo(4.5);
+    radius(cv::Rect(30, 10, 10, 10)).setTo(0);
+    gf.dynamicGuidedFilter(src, guidance, dst, radius, /*eps=*/300);
+
+    cv::Mat streamed(src.size(), CV_32FC1);
+    int nextRow = 0;
+    gf.streamGuidedFilter(
+        src.size(), /*maxRadius=*/4.5f,
+        [&](int x, cv::Mat &srcRow, cv::Mat &guideRow, cv::Mat &radiusRow) {
+          srcRow = src.row(x);
+          guideRow = guidance.row(x);
+          radiusRow = radius.row(x);
+        },
+        [&](int x, const cv::Mat &dstRow) {
+          REQUIRE(x == nextRow++);
+          cv::Mat row = streamed.row(x);
+          dstRow.copyTo(row);
+        },
+        /*eps=*/300);
+    REQUIRE(nextRow == src.rows);
+    REQUIRE(cv::norm(dst, streamed, cv::NORM_INF) == 0);
+  }
+}
+
+TEST_CASE("Fast Guided Filter", "[guided filter]") {
+  const auto img = smoothImage();
+  const auto mask = skinMask(img.size());
+
+  fabsoften::GFOptions opts;
+  opts.radius4skin = 8;
+  cv::Mat expected;
+  fabsoften::GuidedFilter(opts).applyADF(mask, img, img, expected);
+
+  opts.subsample = 2;
+  cv::Mat dst;
+  fabsoften::GuidedFilter(opts).applyADF(mask, img, img, dst);
+
+  cv::Mat imgF;
+  img.convertTo(imgF, CV_32F);
+  cv::Mat unmasked;
+  cv::bitwise_not(mask, unmasked);
+  REQUIRE(cv::norm(dst, imgF, cv::NORM_INF, unmasked) == 0);
+  REQUIRE(cv::PSNR(dst, expected) > 40);
+}
+
+TEST_CASE("Strength Batch", "[guided filter]") {
+  const auto img = smoothImage();
+
+  // The positive radii reach the borders of the image, so every setting filters all of it
+  // and the batch matches separate calls exactly
+  cv::Mat mask(img.size(), CV_8UC1, cv::Scalar(255));
+  mask(cv::Rect(40, 30, 40, 30)).setTo(0);
+
+  SECTION("settings") {
+    std::vector<cv::Mat> radii(3);
+    mask.convertTo(radii[0], CV_32F, 3.0 / 255);
+    mask.convertTo(radii[1], CV_32F, 6.5 / 255);
+    radii[2] = cv::Mat(img.size(), CV_32FC1, cv::Scalar(2));
+    radii[2](cv::Rect(0, 0, 20, 20)).setTo(1.5);
+    cv::Mat epsMap(img.size(), CV_32FC1);
+    cv::randu(epsMap, cv::Scalar(30), cv::Scalar(3000));
+    const std::vector<fabsoften::EpsMap> eps{300.0, fabsoften::EpsMap(epsMap), 30.0};
+
+    const std::array<std::pair<int, int>, 3> configs{{{1, 0}, {1, 32}, {2, 0}}};
+    for (const auto &[subsample, tileSize] : configs) {
+      fabsoften::GFOptions opts;
+      opts.subsample = subsample;
+      opts.tileSize = tileSize;
+      fabsoften::GuidedFilter gf(opts);
+      std::vector<cv::Mat> dsts;
+      gf.dynamicGuidedFilter(img, img, dsts, radii, eps);
+      REQUIRE(dsts.size() == radii.size());
+      for (size_t k = 0; k < radii.size(); ++k) {
+        cv::Mat expected;
+        gf.dynamicGuidedFilter(img, img, expected, radii[k], eps[k]);
+        REQUIRE(cv::norm(dsts[k], expected, cv::NORM_INF) == 0);
+      }
+    }
+  }
+
+  SECTION("applyADF") {
+    fabsoften::GFOptions opts;
+    opts.radius4skin = 8;
+    const std::vector<fabsoften::ADFStrength> strengths{{0.5f, 100}, {1, 300}, {1.5f, 600}};
+    cv::Mat radiusScale(img.size(), CV_32FC1, cv::Scalar(1));
+    radiusScale(cv::Rect(0, 0, 64, 48)).setTo(0.75);
+    for (const auto lumaOnly : {false, true}) {
+      opts.lumaOnly = lumaOnly;
+      std::vector<cv::Mat> dsts;
+      fabsoften::GuidedFilter(opts).applyADF(mask, img, img, strengths, dsts, radiusScale,
+                                             cv::Mat());
+      for (size_t k = 0; k < strengths.size(); ++k) {
+        auto single = opts;
+        single.radius4skin = opts.radius4skin * strengths[k].radiusScale;
+        single.eps = strengths[k].eps;
+        cv::Mat expected;
+        fabsoften::GuidedFilter(single).applyADF(mask, img, img, expected, radiusScale,
+                                                 cv::Mat());
+        REQUIRE(cv::norm(dsts[k], expected, cv::NORM_INF) == 0);
+      }
+    }
+  }
+}
+
+TEST_CASE("Luma-only Filter", "[guided filter]") {
+  const auto img = smoothImage();
+  const auto mask = skinMask(img.size());
+  cv::Mat unmasked;
+  cv::bitwise_not(mask, unmasked);
+
+  fabsoften::GFOptions opts;
+  opts.radius4skin = 8;
+  opts.lumaOnly = true;
+  cv::Mat imgF;
+  img.convertTo(imgF, CV_32F);
+
+  SECTION("chroma pass-through") {
+    cv::Mat dst;
+    fabsoften::GuidedFilter(opts).applyADF(mask, img, img, dst);
+    REQUIRE(cv::norm(dst, imgF, cv::NORM_INF, unmasked) == 0);
+
+    // The color differences are kept, only the luminance is smoothed
+    const auto chroma = cv::Matx23f(-0.114f, -0.587f, 0.701f, 0.886f, -0.587f, -0.299f);
+    cv::Mat srcChroma, dstChroma;
+    cv::transform(imgF, srcChroma, chroma);
+    cv::transform(dst, dstChroma, chroma);
+    REQUIRE(cv::norm(dstChroma, srcChroma, cv::NORM_INF) < 1e-3);
+    REQUIRE(cv::norm(dst, imgF, cv::NORM_INF, mask) > 0);
+  }
+
+  SECTION("masked chroma") {
+    // Uniform skin next to a strongly different color, which must not bleed into it
+    cv::Mat two(img.size(), CV_8UC3, cv::Scalar(40, 200, 40));
+    two.setTo(cv::Scalar(150, 160, 210), mask);
+    cv::Mat twoF;
+    two.convertTo(twoF, CV_32F);
+    fabsoften::GuidedFilter gf(opts);
+    gf.opts.chromaSubsample = 2;
+    cv::Mat dst;
+    gf.applyADF(mask, two, two, dst);
+
+    const auto chroma = cv::Matx23f(-0.114f, -0.587f, 0.701f, 0.886f, -0.587f, -0.299f);
+    cv::Mat srcChroma, dstChroma;
+    cv::transform(twoF, srcChroma, chroma);
+    cv::transform(dst, dstChroma, chroma);
+    REQUIRE(cv::norm(dstChroma, srcChroma, cv::NORM_INF, mask) < 1e-2);
+  }
+
+  SECTION("gray image") {
+    // Without chroma both modes smooth each channel like the luminance itself
+    cv::Mat gray, gray3;
+    cv::cvtColor(img, gray, cv::COLOR_BGR2GRAY);
+    cv::cvtColor(gray, gray3, cv::COLOR_GRAY2BGR);
+    fabsoften::GuidedFilter gf(opts);
+    cv::Mat radius = cv::Mat::zeros(img.size(), CV_32FC1);
+    radius.setTo(opts.radius4skin, mask);
+    cv::Mat expected;
+    gf.dynamicGuidedFilter(gray, img, expected, radius, opts.eps);
+    cv::cvtColor(expected, expected, cv::COLOR_GRAY2BGR);
+
+    for (const auto chromaSubsample : {0, 2}) {
+      gf.opts.chromaSubsample = chromaSubsample;
+      cv::Mat dst;
+      gf.applyADF(mask, img, gray3, dst);
+      REQUIRE(cv::norm(dst, expected, cv::NORM_INF) < 1e-2);
+    }
+  }
+
+  SECTION("half precision") {
+    // The luminance of an 8-bit image is float, but within the range of half precision
+    cv::Mat expected, dst;
+    fabsoften::GuidedFilter(opts).applyADF(mask, img, img, expected);
+    opts.storageDepth = CV_16F;
+    fabsoften::GuidedFilter(opts).applyADF(mask, img, img, dst);
+    REQUIRE(cv::PSNR(dst, expected) > 60);
+
+    cv::Mat img16;
+    img.convertTo(img16, CV_16U, 257);
+    REQUIRE_THROWS_AS(fabsoften::GuidedFilter(opts).applyADF(mask, img16, img16, dst),
+                      cv::Exception);
+  }
+}
+
+TEST_CASE("Half-precision Storage", "[guided filter]") {
+  const auto assetsDir = std::filesystem::path(UNITTEST_PROJECT_DIR) / "assets";
+  for (const auto &entry : std::filesystem::directory_iterator(assetsDir)) {
+    if (entry.path().extension() != ".jpg")
+      continue;
+    INFO(entry.path().filename().string());
+
+    // A quarter of the resolution keeps the test fast
+    auto img = cv::imread(entry.path().string());
+    REQUIRE(!img.empty());
+    cv::pyrDown(img, img);
+    cv::pyrDown(img, img);
+    cv::Mat mask = cv::Mat::zeros(img.size(), CV_8UC1);
+    cv::ellipse(mask, {img.cols / 2, img.rows / 2}, {img.cols * 2 / 5, img.rows * 2 / 5}, 0,
+                0, 360, cv::Scalar(255), cv::FILLED);
+
+    for (const auto subsample : {1, 2}) {
+      fabsoften::GFOptions opts;
+      opts.subsample = subsample;
+      cv::Mat expected;
+      fabsoften::GuidedFilter(opts).applyADF(mask, img, img, expected);
+
+      opts.storageDepth = CV_16F;
+      cv::Mat dst;
+      fabsoften::GuidedFilter(opts).applyADF(mask, img, img, dst);
+      REQUIRE(cv::PSNR(dst, expected) > 60);
+    }
+  }
+}
+
+TEST_CASE("Attribute Maps", "[guided filter]") {
+  cv::Mat src(160, 200, CV_8UC3, cv::Scalar(120, 140, 180));
+  fabsoften::AttributeMapGenerator gen;
+
+  SECTION("neutral skin") {
+    gen.generate(src, {});
+    REQUIRE(gen.hasMaps(src.size()));
+    REQUIRE(cv::norm(gen.getRadiusScale(), cv::Mat::ones(src.size(), CV_32FC1),
+                     cv::NORM_INF) < 1e-6);
+    REQUIRE(cv::norm(gen.getEpsScale(), cv::Mat::ones(src.size(), CV_32FC1),
+                     cv::NORM_INF) < 1e-6);
+  }
+
+  SECTION("blemishes and texture") {
+    std::vector<std::vector<cv::Point>> blemishes;
+    for (int i = 0; i < 5; ++i)
+      for (int j = 0; j < 5; ++j)
+        blemishes.push_back({{10 + 8 * j, 10 + 8 * i},
+                             {16 + 8 * j, 10 + 8 * i},
+                             {16 + 8 * j, 16 + 8 * i},
+                             {10 + 8 * j, 16 + 8 * i}});
+    cv::Mat textured = src(cv::Rect(120, 80, 80, 80));
+    cv::randu(textured, cv::Scalar(0, 0, 0), cv::Scalar(255, 255, 255));
+    gen.generate(src, blemishes);
+
+    const auto &radiusScale = gen.getRadiusScale();
+    const auto &epsScale = gen.getEpsScale();
+    REQUIRE(radiusScale.at<float>(30, 30) > 1);
+    REQUIRE(epsScale.at<float>(30, 30) > 1);
+    REQUIRE(radiusScale.at<float>(150, 190) < 1);
+    REQUIRE(epsScale.at<float>(150, 190) < 1);
+
+    std::set<float> levels;
+    for (int x = 0; x < radiusScale.rows; ++x)
+      for (int y = 0; y < radiusScale.cols; ++y)
+        levels.insert(radiusScale.at<float>(x, y));
+    REQUIRE(levels.size() <= static_cast<size_t>(gen.opts.radiusLevels));
+  }
+}
+
+TEST_CASE("Texture Restoration", "[texture restoration]") {
+  cv::Mat src(60, 80, CV_8UC3);
+  cv::randu(src, cv::Scalar(64, 64, 64), cv::Scalar(192, 192, 192));
+  const cv::Mat mask(src.size(), CV_8UC1, cv::Scalar(255));
+  fabsoften::TextureRestorer restorer;
+  restorer.extractDetail(src);
+
+  // The base layer the detail layer is taken against
+  cv::Mat base;
+  cv::pyrDown(src, base);
+  cv::pyrUp(base, base, src.size());
+  cv::Mat dst;
+
+  SECTION("no restoration") {
+    restorer.opts.strength = 0;
+    restorer.restore(mask, base, dst);
+    REQUIRE(cv::norm(dst, base, cv::NORM_INF) == 0);
+  }
+
+  SECTION("full restoration") {
+    restorer.opts.strength = 1;
+    restorer.restore(mask, base, dst);
+    REQUIRE(cv::norm(dst, src, cv::NORM_INF) <= 1);
+  }
+
+  SECTION("masked") {
+    restorer.opts.strength = 1;
+    const cv::Mat empty = cv::Mat::zeros(src.size(), CV_8UC1);
+    restorer.restore(empty, base, dst);
+    REQUIRE(cv::norm(dst, base, cv::NORM_INF) == 0);
+
+    // No mask restores the detail everywhere
+    restorer.restore(cv::Mat(), base, dst);
+    REQUIRE(cv::norm(dst, src, cv::NORM_INF) <= 1);
+  }
+}
+
+TEST_CASE("Recursive Gaussian", "[blemish detection]") {
+  cv::Mat src(90, 120, CV_32FC1);
+  cv::randu(src, cv::Scalar(0), cv::Scalar(255));
+  cv::Mat dst, ref;
+
+  SECTION("blur") {
+    // Anisotropic, up to a kernel wider than the image
+    const std::array<std::pair<double, double>, 2> sigmas{{{4, 3}, {12, 30}}};
+    for (const auto &[sigmaX, sigmaY] : sigmas) {
+      fabsoften::RecursiveGaussian::blur(src, dst, sigmaX, sigmaY);
+      cv::GaussianBlur(src, ref, cv::Size(0, 0), sigmaX, sigmaY, cv::BORDER_REPLICATE);
+      REQUIRE(cv::norm(dst, ref, cv::NORM_INF) < 2);
+    }
+  }
+
+  SECTION("flat input") {
+    src.setTo(100);
+    fabsoften::RecursiveGaussian::blur(src, dst, 1, 20);
+    REQUIRE(cv::norm(dst, src, cv::NORM_INF) < 1e-3);
+  }
+}
+
+TEST_CASE("Blemish Detection", "[blemish detection]") {
+  // Smooth dark spots wider than the erosion, across the tile borders
+  cv::Mat src(360, 400, CV_8UC3);
+  for (int x = 0; x < src.rows; ++x)
+    for (int y = 0; y < src.cols; ++y) {
+      const auto dx = x % 37 - 18, dy = y % 29 - 14;
+      const auto depth = 80 * std::exp(-(dx * dx + dy * dy) / 50.0);
+      src.at<cv::Vec3b>(x, y) = cv::Vec3b(cv::saturate_cast<uchar>(170 - depth),
+                                           cv::saturate_cast<uchar>(180 - depth),
+                                           cv::saturate_cast<uchar>(200 - depth));
+    }
+  cv::Mat mask(src.size(), CV_8UC1, cv::Scalar(255));
+  mask(cv::Rect(60, 90, 120, 100)).setTo(0);
+
+  // The stages one full-size image after the other
+  cv::Mat gray, coarse, fine, dog, mean, ref;
+  cv::cvtColor(src, gray, cv::COLOR_BGR2GRAY);
+  fabsoften::RecursiveGaussian::blur(gray, coarse, 360 / 200.0, 400 / 200.0);
+  cv::GaussianBlur(gray, fine, cv::Size(3, 3), 0);
+  cv::subtract(coarse, fine, fine);
+  dog = cv::Mat::zeros(src.size(), CV_8UC1);
+  fine.copyTo(dog, mask);
+  const auto sigma = fabsoften::RecursiveGaussian::blockSigma(15);
+  fabsoften::RecursiveGaussian::blur(dog, mean, sigma, sigma);
+  cv::compare(dog, mean, ref, cv::CMP_GT);
+  cv::morphologyEx(ref, ref, cv::MORPH_ERODE,
+                   cv::getStructuringElement(cv::MORPH_ELLIPSE, cv::Size(7, 7)));
+  cv::GaussianBlur(ref, ref, cv::Size(0, 0), 3);
+
+  // Tiles smaller than their halo, not dividing the image, and the whole image at once
+  for (const auto tileSize : {0, 16, 96}) {
+    fabsoften::BlemishRemoverOptions opts;
+    opts.tileSize = tileSize;
+    fabsoften::BlemishRemover remover(opts);
+    remover.computeDoG(src, mask);
+    REQUIRE(cv::norm(remover.getEdgeMap(), ref, cv::NORM_INF) == 0);
+  }
+}
@@ -1,4 +1,10 @@
 #ifndef ADF_H
 #define ADF_H
 
+#include "fabsoften/AttributeMapGenerator.h"
+#include "fabsoften/BlemishRemover.h"
+#include "fabsoften/GuidedFilter.h"
+#include "fabsoften/RecursiveGaussian.h"
+#include "fabsoften/TextureRestorer.h"
+
 #endif
@@ -25,6 +25,23 @@ TEST_CASE("Core", "[Beautifier]") {
     REQUIRE(bf.hasFace());
   }
 
+  SECTION("Soft Mask") {
+    bf.createFace();
+    bf.interpolateLandmarks();
+    cv::Mat binaryMask = cv::Mat::zeros(bf.getWorkImage().size(), CV_8UC1);
+    cv::Mat softMask = binaryMask.clone();
+    bf.drawBinaryMask(binaryMask);
+    bf.drawSoftMask(softMask);
+    // The soft mask is feathered but covers about the same region as the binary mask
+    cv::Mat feathered;
+    cv::inRange(softMask, 1, 254, feathered);
+    REQUIRE(cv::countNonZero(feathered) > 0);
+    const auto binaryArea = cv::countNonZero(binaryMask);
+    const auto softArea = cv::sum(softMask)[0] / 255;
+    REQUIRE(softArea > 0.5 * binaryArea);
+    REQUIRE(softArea < 1.5 * binaryArea);
+  }
+
   SECTION("Curve Fitting Options") {
     const auto &opts = bf.getCurveFittingOpts();
     REQUIRE(opts.nJaw > 0);
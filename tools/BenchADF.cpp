@@ -0,0 +1,87 @@
+/// \file BenchADF.cpp
+/// \brief Measures how the guided filter scales with the number of threads.
+///
+/// BenchADF.exe [params] image
+
+#include "fabsoften/GuidedFilter.h"
+#include <algorithm>
+#include <iostream>
+#include <opencv2/imgcodecs.hpp>
+
+/// \brief Command line keys for command line parsing
+static constexpr auto cmdKeys =
+    "{help h usage ?   |       | print this message                 }"
+    "{@image           |<none> | input image                        }"
+    "{images_dir       |       | search path for images             }"
+    "{threads          |0      | max number of threads(0: all CPUs) }"
+    "{repeat           |5      | number of runs per thread count    }";
+
+int main(int argc, char **argv) {
+  // Handle command line arguments
+  cv::CommandLineParser parser(argc, argv, cmdKeys);
+  if (parser.has("help")) {
+    parser.printMessage();
+    return 0;
+  }
+  if (parser.has("images_dir"))
+    cv::samples::addSamplesDataSearchPath(parser.get<cv::String>("images_dir"));
+
+  // Load image
+  const auto imgArg = parser.get<cv::String>("@image");
+  if (!parser.check()) {
+    parser.printErrors();
+    parser.printMessage();
+    return -1;
+  }
+  // Set `required=false` to prevent `findFile` from throwing an exception.
+  // Instead, we check whether the image is valid via the `empty` method.
+  const auto inputImg =
+      cv::imread(cv::samples::findFile(imgArg, /*required=*/false, /*silentMode=*/true));
+  if (inputImg.empty()) {
+    std::cout << "Could not open or find the image: " << imgArg << "\n"
+              << "The image should be located in `images_dir`.\n";
+    parser.printMessage();
+    return -1;
+  }
+
+  auto maxThreads = parser.get<int>("threads");
+  if (maxThreads <= 0)
+    maxThreads = cv::getNumberOfCPUs();
+  const auto repeat = std::max(parser.get<int>("repeat"), 1);
+
+  // Stand-in for the skin mask: a centered ellipse covering most of the image
+  cv::Mat maskImg = cv::Mat::zeros(inputImg.size(), CV_8UC1);
+  cv::ellipse(maskImg, {inputImg.cols / 2, inputImg.rows / 2},
+              {inputImg.cols * 2 / 5, inputImg.rows * 2 / 5}, 0, 0, 360, cv::Scalar(255),
+              cv::FILLED);
+
+  // Powers of two up to the requested number of threads
+  std::vector<int> threadCounts;
+  for (int nThread = 1; nThread < maxThreads; nThread *= 2)
+    threadCounts.push_back(nThread);
+  threadCounts.push_back(maxThreads);
+
+  std::cout << "image: " << inputImg.cols << "x" << inputImg.rows << "\n"
+            << "threads\tms\tspeedup\n";
+  double baseline = 0;
+  for (const auto nThread : threadCounts) {
+    cv::setNumThreads(nThread);
+    fabsoften::GuidedFilter gf;
+    cv::Mat dst;
+    // Warm up the buffers before timing
+    gf.applyADF(maskImg, inputImg, inputImg, dst);
+
+    cv::TickMeter tm;
+    for (int i = 0; i < repeat; ++i) {
+      tm.start();
+      gf.applyADF(maskImg, inputImg, inputImg, dst);
+      tm.stop();
+    }
+    const auto ms = tm.getTimeMilli() / repeat;
+    if (nThread == 1)
+      baseline = ms;
+    std::cout << nThread << "\t" << ms << "\t" << baseline / ms << "\n";
+  }
+
+  return 0;
+}